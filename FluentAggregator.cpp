@@ -0,0 +1,151 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentAggregator.h"
+
+FluentAggregator::FluentAggregator(FluentLogger *logger, const char *tag, uint32_t window_ms, uint32_t bufsize) :
+_logger(logger), _tag(tag), _window(window_ms), _start(0), _started(false), _nmetrics(0), _mp(bufsize)
+{
+}
+
+int FluentAggregator::add_metric(const char *key, float hist_min, float hist_max)
+{
+    if (_nmetrics == FLUENT_AGGREGATOR_MAX_METRICS) {
+        return -1;
+    }
+    Metric &m = _metrics[_nmetrics];
+    m.key = key;
+    m.hist_min = hist_min;
+    m.hist_max = hist_max;
+    m.count = 0;
+    memset(m.bins, 0, sizeof(m.bins));
+    return _nmetrics++;
+}
+
+void FluentAggregator::reset()
+{
+    for (int i = 0; i < _nmetrics; i++) {
+        _metrics[i].count = 0;
+        memset(_metrics[i].bins, 0, sizeof(_metrics[i].bins));
+    }
+}
+
+int FluentAggregator::add(int id, float value)
+{
+    return add(id, value, Kernel::get_ms_count());
+}
+
+int FluentAggregator::add(int id, float value, uint64_t now_ms)
+{
+    // close the previous window first so the sample lands in the right one
+    int rt = poll(now_ms);
+
+    if (id < 0 || id >= _nmetrics) {
+        return -1;
+    }
+    Metric &m = _metrics[id];
+    if (m.count == 0) {
+        m.min = m.max = value;
+        m.sum = 0;
+    } else {
+        if (value < m.min) {
+            m.min = value;
+        }
+        if (value > m.max) {
+            m.max = value;
+        }
+    }
+    m.sum += value;
+    m.count++;
+
+    if (m.hist_max > m.hist_min) {
+        int bin;
+        if (value < m.hist_min) {
+            bin = 0;
+        } else if (value >= m.hist_max) {
+            bin = FLUENT_AGGREGATOR_BINS - 1;
+        } else {
+            bin = (int)((value - m.hist_min) * FLUENT_AGGREGATOR_BINS / (m.hist_max - m.hist_min));
+            if (bin >= FLUENT_AGGREGATOR_BINS) {
+                bin = FLUENT_AGGREGATOR_BINS - 1;
+            }
+        }
+        m.bins[bin]++;
+    }
+    return rt;
+}
+
+int FluentAggregator::poll()
+{
+    return poll(Kernel::get_ms_count());
+}
+
+int FluentAggregator::poll(uint64_t now_ms)
+{
+    if (!_started) {
+        _start = now_ms;
+        _started = true;
+        return 0;
+    }
+    if (now_ms - _start < _window) {
+        return 0;
+    }
+    // tumbling windows stay on their grid even if polled late
+    _start += ((now_ms - _start) / _window) * _window;
+    return emit();
+}
+
+int FluentAggregator::emit()
+{
+    int used = 0;
+    for (int i = 0; i < _nmetrics; i++) {
+        if (_metrics[i].count > 0) {
+            used++;
+        }
+    }
+    if (used == 0) {
+        return 0;
+    }
+
+    _mp.init();
+    bool ok = _mp.start_map(used + 1)
+              && _mp.set_str("window", 6) && _mp.set_uint(_window);
+    for (int i = 0; ok && i < _nmetrics; i++) {
+        Metric &m = _metrics[i];
+        if (m.count == 0) {
+            continue;
+        }
+        bool hist = m.hist_max > m.hist_min;
+        ok = _mp.set_str(m.key, strlen(m.key))
+             && _mp.start_map(hist ? 5 : 4)
+             && _mp.set_str("count", 5) && _mp.set_uint(m.count)
+             && _mp.set_str("min", 3) && _mp.set_float(m.min)
+             && _mp.set_str("max", 3) && _mp.set_float(m.max)
+             && _mp.set_str("mean", 4) && _mp.set_float((float)(m.sum / m.count));
+        if (ok && hist) {
+            ok = _mp.set_str("hist", 4) && _mp.start_array(FLUENT_AGGREGATOR_BINS);
+            for (int b = 0; ok && b < FLUENT_AGGREGATOR_BINS; b++) {
+                ok = _mp.set_uint(m.bins[b]);
+            }
+        }
+    }
+    reset();
+    if (!ok) {
+        return -1;
+    }
+    return _logger->log(_tag, _mp);
+}
@@ -0,0 +1,136 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_AGGREGATOR_MBED_H
+#define FLUENT_AGGREGATOR_MBED_H
+#include "mbed.h"
+#include "FluentLogger.h"
+#include "uMP.h"
+
+/** Maximum number of metrics per aggregator */
+#ifndef FLUENT_AGGREGATOR_MAX_METRICS
+#define FLUENT_AGGREGATOR_MAX_METRICS 8
+#endif
+
+/** Number of histogram bins per metric */
+#ifndef FLUENT_AGGREGATOR_BINS
+#define FLUENT_AGGREGATOR_BINS 8
+#endif
+
+/** Per-window summaries of sampled values
+ *
+ * Samples are folded into constant size accumulators (count, min, max,
+ * mean and an optional histogram) per metric. When a tumbling window
+ * closes, one record
+ *
+ *   {"window": ms, "<key>": {"count", "min", "max", "mean", "hist"}, ...}
+ *
+ * is logged for all metrics that got samples, instead of one record
+ * per sample.
+ */
+class FluentAggregator {
+public:
+    /** Create an aggregator
+     *
+     * @param logger logger that receives the summaries
+     * @param tag tag of the summary records
+     * @param window_ms window length in milliseconds
+     * @param bufsize summary record buffer length (default: 256)
+     */
+    FluentAggregator(FluentLogger *logger, const char *tag, uint32_t window_ms, uint32_t bufsize = 256);
+
+    /** Register a metric
+     *
+     * The key string is kept by reference and must stay valid. A
+     * histogram of FLUENT_AGGREGATOR_BINS equal bins over [hist_min, hist_max)
+     * is kept when hist_max > hist_min; values outside go to the first/last bin.
+     *
+     * @param key metric name
+     * @param hist_min lower bound of the histogram
+     * @param hist_max upper bound of the histogram
+     * @retval >=0 metric id
+     * @retval -1 Failure (too many metrics)
+     */
+    int add_metric(const char *key, float hist_min = 0.0f, float hist_max = 0.0f);
+
+    /** Add a sample
+     *
+     * @param id metric id
+     * @param value sample
+     * @retval 0 Success
+     * @retval <0 Failure (logging the closed window failed)
+     */
+    int add(int id, float value);
+
+    /** Add a sample at a given time
+     *
+     * @param id metric id
+     * @param value sample
+     * @param now_ms current time in milliseconds
+     * @retval 0 Success
+     * @retval <0 Failure (logging the closed window failed)
+     */
+    int add(int id, float value, uint64_t now_ms);
+
+    /** Close the window if it is over (call periodically)
+     *
+     * @retval 0 Success
+     * @retval <0 Failure (logging the closed window failed)
+     */
+    int poll();
+
+    /** Close the window if it is over at a given time
+     *
+     * @param now_ms current time in milliseconds
+     * @retval 0 Success
+     * @retval <0 Failure (logging the closed window failed)
+     */
+    int poll(uint64_t now_ms);
+
+    /** Log the current window now and start a new one
+     *
+     * @retval 0 Success
+     * @retval <0 Failure
+     */
+    int emit();
+
+private:
+    struct Metric {
+        const char *key;
+        uint32_t   count;
+        float      min;
+        float      max;
+        double     sum;
+        float      hist_min;
+        float      hist_max;
+        uint32_t   bins[FLUENT_AGGREGATOR_BINS];
+    };
+
+    /** Reset accumulators of all metrics
+     */
+    void reset();
+
+    FluentLogger *_logger;
+    const char   *_tag;
+    uint32_t     _window;
+    uint64_t     _start;
+    bool         _started;
+    int          _nmetrics;
+    Metric       _metrics[FLUENT_AGGREGATOR_MAX_METRICS];
+    uMP          _mp;
+};
+
+#endif // FLUENT_AGGREGATOR_MBED_H
@@ -0,0 +1,283 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentAuth.h"
+#include "uMP.h"
+#include "mbed_trace.h"
+#include "mbedtls/sha512.h"
+#if DEVICE_TRNG
+#include "hal/trng_api.h"
+#endif
+
+#define TRACE_GROUP "FLUENTLOGGER"
+
+FluentAuth::FluentAuth(const char *self_hostname, const char *shared_key, const char *username, const char *password) :
+_self_hostname(self_hostname), _shared_key(shared_key),
+_username(username ? username : ""), _password(password ? password : ""), _keepalive(true)
+{
+    _salt[0] = '\0';
+}
+
+void FluentAuth::digest(char hex[129], const void *a, uint32_t na, const void *b, uint32_t nb,
+                        const void *c, uint32_t nc, const void *d, uint32_t nd)
+{
+    static const char digits[] = "0123456789abcdef";
+    mbedtls_sha512_context ctx;
+    uint8_t md[64];
+
+    mbedtls_sha512_init(&ctx);
+    mbedtls_sha512_starts_ret(&ctx, 0);
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)a, na);
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)b, nb);
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)c, nc);
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)d, nd);
+    mbedtls_sha512_finish_ret(&ctx, md);
+    mbedtls_sha512_free(&ctx);
+
+    for (int i = 0; i < 64; i++) {
+        hex[i * 2]     = digits[md[i] >> 4];
+        hex[i * 2 + 1] = digits[md[i] & 0x0f];
+    }
+    hex[128] = '\0';
+}
+
+bool FluentAuth::make_salt()
+{
+#if DEVICE_TRNG
+    static const char digits[] = "0123456789abcdef";
+    uint8_t rnd[16];
+    size_t got = 0;
+    trng_t trng;
+
+    // a predictable salt would let a recorded PONG be replayed, so there is no fallback
+    trng_init(&trng);
+    while (got < sizeof(rnd)) {
+        size_t len = 0;
+        if (trng_get_bytes(&trng, rnd + got, sizeof(rnd) - got, &len) != 0 || len == 0) {
+            break;
+        }
+        got += len;
+    }
+    trng_free(&trng);
+    if (got != sizeof(rnd)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(rnd); i++) {
+        _salt[i * 2]     = digits[rnd[i] >> 4];
+        _salt[i * 2 + 1] = digits[rnd[i] & 0x0f];
+    }
+    _salt[32] = '\0';
+    return true;
+#else
+    return false;
+#endif
+}
+
+int FluentAuth::send_buffered(FluentTransport *transport, uMP &mp)
+{
+    const uint8_t *p = mp.get_buffer();
+    uint32_t size = mp.get_size();
+    while (size > 0) {
+        nsapi_size_or_error_t sent = transport->send(p, size);
+        if (sent < 0) {
+            return sent;
+        }
+        p += sent;
+        size -= sent;
+    }
+    mp.init();
+    return NSAPI_ERROR_OK;
+}
+
+int FluentAuth::put_str(FluentTransport *transport, uMP &mp, const char *s, uint32_t n)
+{
+    uint32_t size = mp.get_size();
+    if (mp.set_str(s, n)) {
+        return NSAPI_ERROR_OK;
+    }
+    mp.rewind(size);
+    int rt = send_buffered(transport, mp);
+    if (rt != NSAPI_ERROR_OK) {
+        return rt;
+    }
+    return mp.set_str(s, n) ? NSAPI_ERROR_OK : NSAPI_ERROR_NO_MEMORY;
+}
+
+int FluentAuth::recv_object(FluentTransport *transport, uint8_t *buf, uint32_t *size)
+{
+    uint32_t len = 0;
+    for (;;) {
+        uMPReader rd(buf, len);
+        if (len > 0 && rd.skip()) {
+            *size = rd.get_pos();
+            return NSAPI_ERROR_OK;
+        }
+        if (len == FLUENT_AUTH_BUFSIZE) {
+            return NSAPI_ERROR_NO_MEMORY;
+        }
+        nsapi_size_or_error_t n = transport->recv(buf + len, FLUENT_AUTH_BUFSIZE - len);
+        if (n == 0) {
+            return NSAPI_ERROR_CONNECTION_LOST;
+        }
+        if (n < 0) {
+            return n;
+        }
+        len += n;
+    }
+}
+
+/* compare a MessagePack string with a C string */
+static bool str_equals(const char *s, uint32_t n, const char *c)
+{
+    return n == strlen(c) && memcmp(s, c, n) == 0;
+}
+
+int FluentAuth::handshake(FluentTransport *transport)
+{
+    uint8_t buf[FLUENT_AUTH_BUFSIZE];
+    uint32_t size;
+    uint32_t n;
+    const char *s;
+    uint32_t ns;
+
+    // ["HELO", {"nonce": nonce, "auth": salt, "keepalive": bool}]
+    int rt = recv_object(transport, buf, &size);
+    if (rt != NSAPI_ERROR_OK) {
+        tr_debug("No HELO from server (%d)", rt);
+        return rt;
+    }
+
+    uint8_t nonce[64];
+    uint32_t nnonce = 0;
+    uint8_t auth[64];
+    uint32_t nauth = 0;
+    _keepalive = true;
+
+    uMPReader rd(buf, size);
+    if (!rd.get_array(&n) || n < 2 || !rd.get_str(&s, &ns) || !str_equals(s, ns, "HELO") || !rd.get_map(&n)) {
+        tr_debug("Invalid HELO");
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+    while (n--) {
+        const char *key;
+        uint32_t nkey;
+        const uint8_t *v;
+        uint32_t nv;
+        if (!rd.get_str(&key, &nkey)) {
+            return NSAPI_ERROR_AUTH_FAILURE;
+        }
+        // nonce and auth salt come as bin or str depending on the fluentd version
+        bool is_bytes = rd.get_bin(&v, &nv) || rd.get_str((const char **)&v, &nv);
+        if (is_bytes && str_equals(key, nkey, "nonce") && nv <= sizeof(nonce)) {
+            memcpy(nonce, v, nv);
+            nnonce = nv;
+        } else if (is_bytes && str_equals(key, nkey, "auth") && nv <= sizeof(auth)) {
+            memcpy(auth, v, nv);
+            nauth = nv;
+        } else if (!is_bytes && str_equals(key, nkey, "keepalive")) {
+            if (!rd.get_bool(&_keepalive)) {
+                return NSAPI_ERROR_AUTH_FAILURE;
+            }
+        } else if (!is_bytes && !rd.skip()) {
+            return NSAPI_ERROR_AUTH_FAILURE;
+        }
+    }
+    if (nnonce == 0) {
+        tr_debug("HELO without nonce");
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+
+    // ["PING", self_hostname, shared_key_salt, sha512_hex(salt + self_hostname + nonce + shared_key),
+    //  username, sha512_hex(auth_salt + username + password)]
+    char hex[129];
+    uint32_t nhost = strlen(_self_hostname);
+    uint32_t nkey = strlen(_shared_key);
+    uint32_t nuser = strlen(_username);
+    if (nhost > 0xff || nuser > 0xff || nhost + 2 > sizeof(buf) || nuser + 2 > sizeof(buf)) {
+        tr_error("self_hostname or username too long");
+        return NSAPI_ERROR_NO_MEMORY;
+    }
+    if (!make_salt()) {
+        tr_error("No TRNG for the shared key salt");
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+
+    // with user auth the PING can exceed buf, full parts are sent while it is built
+    uMP mp(buf, sizeof(buf));
+    if (!mp.start_array(6)) {
+        return NSAPI_ERROR_NO_MEMORY;
+    }
+    rt = put_str(transport, mp, "PING", 4);
+    if (rt == NSAPI_ERROR_OK) {
+        rt = put_str(transport, mp, _self_hostname, nhost);
+    }
+    if (rt == NSAPI_ERROR_OK) {
+        rt = put_str(transport, mp, _salt, 32);
+    }
+    if (rt == NSAPI_ERROR_OK) {
+        digest(hex, _salt, 32, _self_hostname, nhost, nonce, nnonce, _shared_key, nkey);
+        rt = put_str(transport, mp, hex, 128);
+    }
+    if (rt == NSAPI_ERROR_OK) {
+        rt = put_str(transport, mp, _username, nuser);
+    }
+    if (rt == NSAPI_ERROR_OK && nauth > 0) {
+        digest(hex, auth, nauth, _username, nuser, _password, strlen(_password), NULL, 0);
+        rt = put_str(transport, mp, hex, 128);
+    } else if (rt == NSAPI_ERROR_OK) {
+        rt = put_str(transport, mp, "", 0);
+    }
+    if (rt == NSAPI_ERROR_OK) {
+        rt = send_buffered(transport, mp);
+    }
+    if (rt != NSAPI_ERROR_OK) {
+        tr_debug("PING not sent (%d)", rt);
+        return rt;
+    }
+
+    // ["PONG", auth_result, reason, server_hostname, sha512_hex(salt + server_hostname + nonce + shared_key)]
+    rt = recv_object(transport, buf, &size);
+    if (rt != NSAPI_ERROR_OK) {
+        tr_debug("No PONG from server (%d)", rt);
+        return rt;
+    }
+    uMPReader pong(buf, size);
+    bool ok = false;
+    const char *server;
+    uint32_t nserver;
+    if (!pong.get_array(&n) || n != 5 || !pong.get_str(&s, &ns) || !str_equals(s, ns, "PONG")
+        || !pong.get_bool(&ok)) {
+        tr_debug("Invalid PONG");
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+    if (!ok) {
+        if (pong.get_str(&s, &ns)) {
+            tr_debug("Authentication rejected: %.*s", (int)ns, s);
+        }
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+    if (!pong.skip() || !pong.get_str(&server, &nserver) || !pong.get_str(&s, &ns) || ns != 128) {
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+    // the server proves it knows the shared key as well
+    digest(hex, _salt, 32, server, nserver, nonce, nnonce, _shared_key, nkey);
+    if (memcmp(hex, s, 128) != 0) {
+        tr_debug("Server digest mismatch");
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+    return NSAPI_ERROR_OK;
+}
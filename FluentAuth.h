@@ -0,0 +1,121 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_AUTH_MBED_H
+#define FLUENT_AUTH_MBED_H
+#include "mbed.h"
+#include "FluentTransport.h"
+#include "uMP.h"
+
+/** Buffer size for HELO/PONG, PING is sent in parts when it does not fit */
+#ifndef FLUENT_AUTH_BUFSIZE
+#define FLUENT_AUTH_BUFSIZE 256
+#endif
+
+/** Forward protocol shared key authentication
+ *
+ * Runs the HELO/PING/PONG handshake of fluentd's <security> section
+ * once per connection, authenticating both ends without TLS. Messages
+ * are not encrypted.
+ *
+ * The salt of every handshake comes from the TRNG, a replayed PONG does
+ * not match it. Targets without DEVICE_TRNG cannot use authentication,
+ * handshake() fails with NSAPI_ERROR_UNSUPPORTED there.
+ */
+class FluentAuth {
+public:
+    /** Create shared key authentication
+     *
+     * Strings are kept by reference and must stay valid.
+     *
+     * @param self_hostname name of this client (self_hostname)
+     * @param shared_key shared key of the server
+     * @param username user name, if the server requires user auth (optional)
+     * @param password password, if the server requires user auth (optional)
+     */
+    FluentAuth(const char *self_hostname, const char *shared_key, const char *username = NULL, const char *password = NULL);
+
+    /** Authenticate a freshly connected transport
+     *
+     * @param transport connected transport
+     * @retval 0 Success
+     * @retval NSAPI_ERROR_AUTH_FAILURE rejected by the server or server digest mismatch
+     * @retval NSAPI_ERROR_UNSUPPORTED no TRNG to generate the salt
+     * @retval NSAPI_ERROR_NO_MEMORY self_hostname or username longer than 255 bytes or FLUENT_AUTH_BUFSIZE - 2
+     * @retval <0 other nsapi error code
+     */
+    int handshake(FluentTransport *transport);
+
+    /** Check whether the server keeps the connection open after authentication
+     *
+     * @retval true keepalive was announced in the last HELO
+     */
+    inline bool keepalive() const { return _keepalive; }
+
+private:
+    /** Receive one complete MessagePack object
+     *
+     * @param transport transport
+     * @param buf receive buffer
+     * @param size size of the object
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    int recv_object(FluentTransport *transport, uint8_t *buf, uint32_t *size);
+
+    /** Generate the shared key salt
+     *
+     * @retval true Success
+     * @retval false no random source
+     */
+    bool make_salt();
+
+    /** Append a string to the PING, sending the buffered part first when it does not fit
+     *
+     * @param transport transport
+     * @param mp PING encoder
+     * @param s string
+     * @param n length of s
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    static int put_str(FluentTransport *transport, uMP &mp, const char *s, uint32_t n);
+
+    /** Send the buffered part of the PING
+     *
+     * @param transport transport
+     * @param mp PING encoder, emptied on success
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    static int send_buffered(FluentTransport *transport, uMP &mp);
+
+    /** SHA-512 over the concatenation of up to four strings, as lowercase hex
+     *
+     * The parts are hashed incrementally, nothing is concatenated.
+     */
+    static void digest(char hex[129], const void *a, uint32_t na, const void *b, uint32_t nb,
+                       const void *c, uint32_t nc, const void *d, uint32_t nd);
+
+    const char *_self_hostname;
+    const char *_shared_key;
+    const char *_username;
+    const char *_password;
+    bool       _keepalive;
+    char       _salt[33];
+};
+
+#endif // FLUENT_AUTH_MBED_H
@@ -0,0 +1,241 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FluentDelta.h"
+
+/* ext32 header written ahead of the data, its length is patched in finish() */
+#define DELTA_HEADER_SIZE   6
+
+FluentDeltaEncoder::FluentDeltaEncoder(uint32_t bufsize) :
+_mp(bufsize), _nkeys(0), _last_time(0), _nrecords(0), _closed(true), _time(0)
+{
+}
+
+int FluentDeltaEncoder::add_key(const char *key)
+{
+    if (_nkeys == FLUENT_DELTA_MAX_KEYS) {
+        return -1;
+    }
+    _keys[_nkeys] = key;
+    _values[_nkeys].type = VALUE_NONE;
+    return _nkeys++;
+}
+
+void FluentDeltaEncoder::begin(uint32_t time)
+{
+    _time = time;
+    for (int i = 0; i < _nkeys; i++) {
+        _values[i].type = VALUE_NONE;
+    }
+}
+
+void FluentDeltaEncoder::set(int key, int32_t v)
+{
+    if (key >= 0 && key < _nkeys) {
+        _values[key].type = VALUE_INT;
+        _values[key].i = v;
+    }
+}
+
+void FluentDeltaEncoder::set(int key, float v)
+{
+    if (key >= 0 && key < _nkeys) {
+        _values[key].type = VALUE_FLOAT;
+        _values[key].f = v;
+    }
+}
+
+void FluentDeltaEncoder::set(int key, const char *v)
+{
+    if (key >= 0 && key < _nkeys) {
+        _values[key].type = VALUE_STR;
+        _values[key].s = v;
+    }
+}
+
+bool FluentDeltaEncoder::end()
+{
+    uint32_t mark = _mp.get_size();
+    bool fresh = _closed;
+    if (fresh) {
+        // a size above 0xffff forces the fixed length ext32 header
+        _mp.init();
+        bool ok = _mp.start_ext(FLUENT_DELTA_EXT_TYPE, 0x10000) && _mp.start_array(_nkeys);
+        for (int i = 0; i < _nkeys; i++) {
+            ok = ok && _mp.set_str(_keys[i], strlen(_keys[i]));
+            _last[i] = 0;
+        }
+        if (!ok || !_mp.set_uint(_time)) {
+            // the dictionary alone does not fit
+            _mp.init();
+            return false;
+        }
+        _last_time = _time;
+        _nrecords = 0;
+        _closed = false;
+    }
+    if (!encode()) {
+        if (fresh) {
+            // does not fit even into an empty batch
+            _closed = true;
+            _mp.init();
+        } else {
+            _mp.rewind(mark);
+        }
+        return false;
+    }
+    _nrecords++;
+    return true;
+}
+
+bool FluentDeltaEncoder::encode()
+{
+    // time goes backwards only across a clock adjustment, send it as a signed delta
+    int64_t dt = (int64_t)_time - _last_time;
+    if (!_mp.set_sint(dt)) {
+        return false;
+    }
+    int64_t last[FLUENT_DELTA_MAX_KEYS];
+    for (int i = 0; i < _nkeys; i++) {
+        bool ok;
+        last[i] = _last[i];
+        switch (_values[i].type) {
+            case VALUE_INT: {
+                int64_t d = (int64_t)_values[i].i - _last[i];
+                last[i] = _values[i].i;
+                ok = _mp.set_sint(d);
+                break;
+            }
+            case VALUE_FLOAT:
+                ok = _mp.set_float(_values[i].f);
+                break;
+            case VALUE_STR:
+                ok = _mp.set_str(_values[i].s);
+                break;
+            default:
+                ok = _mp.set_nil();
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    // commit the running state only once the whole record fits
+    for (int i = 0; i < _nkeys; i++) {
+        _last[i] = last[i];
+    }
+    _last_time = _time;
+    return true;
+}
+
+uMP &FluentDeltaEncoder::finish()
+{
+    if (!_closed) {
+        uint32_t n = _mp.get_size() - DELTA_HEADER_SIZE;
+        uint8_t *p = _mp.get_buffer();
+        p[1] = n >> 24;
+        p[2] = n >> 16;
+        p[3] = n >> 8;
+        p[4] = n;
+        _closed = true;
+    }
+    return _mp;
+}
+
+FluentDeltaDecoder::FluentDeltaDecoder(const uint8_t *data, uint32_t size) :
+_rd(data, size), _valid(true), _nkeys(0), _time(0)
+{
+    uint32_t n;
+    uint64_t t;
+    if (!_rd.get_array(&n) || n > FLUENT_DELTA_MAX_KEYS) {
+        _valid = false;
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (!_rd.get_str(&_keys[i], &_nkey[i])) {
+            _valid = false;
+            return;
+        }
+        _last[i] = 0;
+    }
+    if (!_rd.get_uint(&t)) {
+        _valid = false;
+        return;
+    }
+    _nkeys = n;
+    _time = (uint32_t)t;
+}
+
+bool FluentDeltaDecoder::next(uint32_t *time, uMP &out)
+{
+    if (!has_more()) {
+        return false;
+    }
+    // work on a copy of the state, so a record that does not fit into
+    // out is read again by the next call
+    uMPReader rd = _rd;
+    int64_t dt;
+    if (!rd.get_sint(&dt)) {
+        _valid = false;
+        return false;
+    }
+    uint32_t t = _time + (int32_t)dt;
+
+    // values are checked before anything is written
+    const uint8_t *v[FLUENT_DELTA_MAX_KEYS];
+    uint32_t nv[FLUENT_DELTA_MAX_KEYS];
+    int npairs = 0;
+    for (int i = 0; i < _nkeys; i++) {
+        if (!rd.skip(&v[i], &nv[i])) {
+            _valid = false;
+            return false;
+        }
+        if (!(nv[i] == 1 && v[i][0] == 0xc0)) {
+            npairs++;
+        }
+    }
+
+    uint32_t mark = out.get_size();
+    int64_t last[FLUENT_DELTA_MAX_KEYS];
+    bool ok = out.start_map(npairs);
+    for (int i = 0; i < _nkeys && ok; i++) {
+        last[i] = _last[i];
+        if (nv[i] == 1 && v[i][0] == 0xc0) {
+            continue;
+        }
+        ok = out.set_str(_keys[i], _nkey[i]);
+        uMPReader value(v[i], nv[i]);
+        int64_t d;
+        if (ok && value.get_sint(&d)) {
+            last[i] += d;
+            ok = out.set_sint(last[i]);
+        } else if (ok) {
+            ok = out.set_raw((const char *)v[i], nv[i]);
+        }
+    }
+    if (!ok) {
+        // out is full, the batch itself is fine
+        out.rewind(mark);
+        return false;
+    }
+    _rd = rd;
+    _time = t;
+    for (int i = 0; i < _nkeys; i++) {
+        _last[i] = last[i];
+    }
+    *time = t;
+    return true;
+}
@@ -0,0 +1,195 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_DELTA_H
+#define FLUENT_DELTA_H
+#include <stdint.h>
+#include "uMP.h"
+
+/* Delta encoded record batches (shared by the device and the relays)
+ *
+ * A batch of records with the same keys is sent as one record of
+ * extension type FLUENT_DELTA_EXT_TYPE whose data is a sequence of
+ * MessagePack objects:
+ *
+ *   [key, ...] base_time (dt, v0, v1, ...)*
+ *
+ * The key dictionary is sent once. Each record has a time delta to the
+ * previous record and one value per key: nil when the key is absent,
+ * the difference to the previous integer of that key for integers
+ * (small changes fit into a single byte), anything else as is. The
+ * relays expand the batch back into plain {key: value} records.
+ */
+
+/** Extension type of a delta encoded batch */
+#ifndef FLUENT_DELTA_EXT_TYPE
+#define FLUENT_DELTA_EXT_TYPE   16
+#endif
+
+/** Maximum number of keys per batch */
+#ifndef FLUENT_DELTA_MAX_KEYS
+#define FLUENT_DELTA_MAX_KEYS   8
+#endif
+
+/** Delta batch encoder
+ *
+ *   FluentDeltaEncoder batch(512);
+ *   int temp = batch.add_key("temp");
+ *   batch.begin(now);
+ *   batch.set(temp, reading);
+ *   if (!batch.end()) {                 // batch full
+ *       logger.log("sensor", batch.finish());
+ *       batch.end();
+ *   }
+ */
+class FluentDeltaEncoder {
+public:
+    /** Create encoder
+     *
+     * @param bufsize batch buffer length (default: 256)
+     */
+    explicit FluentDeltaEncoder(uint32_t bufsize = 256);
+
+    /** Add a key to the dictionary (before the first record)
+     *
+     * The key string is kept by reference and must stay valid.
+     *
+     * @param key key name
+     * @retval >=0 key id
+     * @retval -1 Failure (too many keys)
+     */
+    int add_key(const char *key);
+
+    /** Start a record
+     *
+     * @param time record time (seconds, 0: stamped by the relay)
+     */
+    void begin(uint32_t time);
+
+    /** Set an integer value of the current record
+     * @param key key id
+     * @param v value
+     */
+    void set(int key, int32_t v);
+
+    /** Set a float value of the current record
+     * @param key key id
+     * @param v value
+     */
+    void set(int key, float v);
+
+    /** Set a string value of the current record (kept by reference until end())
+     * @param key key id
+     * @param v null terminated string
+     */
+    void set(int key, const char *v);
+
+    /** Append the current record to the batch
+     *
+     * On failure the batch is full: log finish() and call end() again,
+     * the record is still staged.
+     *
+     * @retval true Success
+     * @retval false Failure (batch full)
+     */
+    bool end();
+
+    /** Get number of records in the batch
+     */
+    inline uint32_t get_records() const { return _nrecords; }
+
+    /** Close the batch
+     *
+     * The returned record is valid until the next end(); the next
+     * record starts a new batch.
+     *
+     * @return batch record, e.g. for FluentLogger::log()
+     */
+    uMP &finish();
+
+private:
+    enum {
+        VALUE_NONE,
+        VALUE_INT,
+        VALUE_FLOAT,
+        VALUE_STR
+    };
+
+    /** Encode one record
+     */
+    bool encode();
+
+    uMP         _mp;
+    int         _nkeys;
+    const char  *_keys[FLUENT_DELTA_MAX_KEYS];
+    int64_t     _last[FLUENT_DELTA_MAX_KEYS];
+    uint32_t    _last_time;
+    uint32_t    _nrecords;
+    bool        _closed;
+    uint32_t    _time;
+    struct {
+        uint8_t type;
+        union {
+            int32_t    i;
+            float      f;
+            const char *s;
+        };
+    } _values[FLUENT_DELTA_MAX_KEYS];
+};
+
+/** Delta batch decoder
+ *
+ */
+class FluentDeltaDecoder {
+public:
+    /** Create decoder
+     *
+     * @param data extension data of a FLUENT_DELTA_EXT_TYPE record
+     * @param size Size of extension data
+     */
+    FluentDeltaDecoder(const uint8_t *data, uint32_t size);
+
+    /** Expand the next record
+     *
+     * When out is full nothing is appended and has_more() stays true:
+     * make room and call again to get the same record.
+     *
+     * @param time record time
+     * @param out the {key: value} map is appended here
+     * @retval true Success
+     * @retval false no more records, malformed batch (see is_valid()) or out full
+     */
+    bool next(uint32_t *time, uMP &out);
+
+    /** Check that the batch was well formed so far
+     */
+    inline bool is_valid() const { return _valid; }
+
+    /** Check whether records are left to expand
+     */
+    inline bool has_more() const { return _valid && _rd.get_remaining() > 0; }
+
+private:
+    uMPReader   _rd;
+    bool        _valid;
+    int         _nkeys;
+    const char  *_keys[FLUENT_DELTA_MAX_KEYS];
+    uint32_t    _nkey[FLUENT_DELTA_MAX_KEYS];
+    int64_t     _last[FLUENT_DELTA_MAX_KEYS];
+    uint32_t    _time;
+};
+
+#endif // FLUENT_DELTA_H
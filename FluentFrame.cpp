@@ -0,0 +1,155 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FluentFrame.h"
+
+#define SLIP_END        0xc0
+#define SLIP_ESC        0xdb
+#define SLIP_ESC_END    0xdc
+#define SLIP_ESC_ESC    0xdd
+
+uint16_t fluent_crc16(uint16_t crc, const uint8_t *data, uint32_t size)
+{
+    while (size--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* Encoder */
+FluentFrameEncoder::FluentFrameEncoder(Output out, void *ctx) :
+_out(out), _ctx(ctx), _crc(0xffff), _err(0), _n(0)
+{
+}
+
+void FluentFrameEncoder::flush()
+{
+    if (_n > 0 && _err == 0) {
+        _err = _out(_ctx, _stage, _n);
+    }
+    _n = 0;
+}
+
+void FluentFrameEncoder::put(uint8_t c)
+{
+    if (_n == sizeof(_stage)) {
+        flush();
+    }
+    _stage[_n++] = c;
+}
+
+void FluentFrameEncoder::put_escaped(uint8_t c)
+{
+    if (c == SLIP_END) {
+        put(SLIP_ESC);
+        put(SLIP_ESC_END);
+    } else if (c == SLIP_ESC) {
+        put(SLIP_ESC);
+        put(SLIP_ESC_ESC);
+    } else {
+        put(c);
+    }
+}
+
+int FluentFrameEncoder::begin(uint16_t seq)
+{
+    uint8_t hdr[2] = { (uint8_t)(seq >> 8), (uint8_t)seq };
+    _err = 0;
+    _n = 0;
+    _crc = 0xffff;
+    // leading END flushes any line noise on the receiver
+    put(SLIP_END);
+    return write(hdr, sizeof(hdr));
+}
+
+int FluentFrameEncoder::write(const void *data, uint32_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    _crc = fluent_crc16(_crc, p, size);
+    while (size--) {
+        put_escaped(*p++);
+    }
+    return _err;
+}
+
+int FluentFrameEncoder::end()
+{
+    uint16_t crc = _crc;
+    put_escaped((uint8_t)(crc >> 8));
+    put_escaped((uint8_t)crc);
+    put(SLIP_END);
+    flush();
+    return _err;
+}
+
+/* Decoder */
+FluentFrameDecoder::FluentFrameDecoder(uint8_t *buf, uint32_t size) :
+_buf(buf), _nbuf(size), _ptr(0), _esc(false), _overflow(false), _seq(0), _len(0), _errors(0)
+{
+}
+
+uint32_t FluentFrameDecoder::feed(const uint8_t *data, uint32_t size, bool *frame)
+{
+    uint32_t i;
+    *frame = false;
+
+    for (i = 0; i < size; i++) {
+        uint8_t c = data[i];
+
+        if (c == SLIP_END) {
+            uint32_t n = _ptr;
+            bool overflow = _overflow;
+            _ptr = 0;
+            _esc = false;
+            _overflow = false;
+            if (n == 0 && !overflow) {
+                continue;   // empty frame between two ENDs
+            }
+            if (overflow || n < 4 || fluent_crc16(0xffff, _buf, n - 2) != (uint16_t)((_buf[n - 2] << 8) | _buf[n - 1])) {
+                _errors++;
+                continue;
+            }
+            _seq = (uint16_t)((_buf[0] << 8) | _buf[1]);
+            _len = n - 4;
+            *frame = true;
+            return i + 1;
+        }
+
+        if (_esc) {
+            _esc = false;
+            if (c == SLIP_ESC_END) {
+                c = SLIP_END;
+            } else if (c == SLIP_ESC_ESC) {
+                c = SLIP_ESC;
+            } else {
+                _overflow = true;   // protocol violation, drop the frame
+            }
+        } else if (c == SLIP_ESC) {
+            _esc = true;
+            continue;
+        }
+
+        if (_ptr == _nbuf) {
+            _overflow = true;
+            continue;
+        }
+        _buf[_ptr++] = c;
+    }
+    return i;
+}
@@ -0,0 +1,158 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_FRAME_H
+#define FLUENT_FRAME_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* Serial link framing (shared by the device and the gateway relay)
+ *
+ * Each frame is SLIP (RFC 1055) encoded and carries
+ *
+ *   seq (u16, big endian) | payload | crc16 (u16, big endian)
+ *
+ * where the CRC (CCITT, poly 0x1021, init 0xffff) covers seq and payload,
+ * and the payload is a batch of [tag, time, record] messages.
+ */
+
+/** Staging buffer size of the frame encoder */
+#ifndef FLUENT_FRAME_STAGE_SIZE
+#define FLUENT_FRAME_STAGE_SIZE 64
+#endif
+
+/** Update CRC-16/CCITT
+ *
+ * @param crc current value (0xffff to start)
+ * @param data Pointer of data
+ * @param size Size of data
+ * @return updated CRC
+ */
+uint16_t fluent_crc16(uint16_t crc, const uint8_t *data, uint32_t size);
+
+/** Frame encoder
+ *
+ * Escapes data through a small staging buffer that is handed to
+ * the output function whenever it fills up.
+ */
+class FluentFrameEncoder {
+public:
+    /** Output function
+     *
+     * @param ctx context given to the constructor
+     * @param data Pointer of encoded bytes
+     * @param size Size of encoded bytes
+     * @retval 0 Success
+     * @retval <0 Failure
+     */
+    typedef int (*Output)(void *ctx, const uint8_t *data, uint32_t size);
+
+    /** Create frame encoder
+     *
+     * @param out output function
+     * @param ctx context for the output function
+     */
+    FluentFrameEncoder(Output out, void *ctx);
+
+    /** Start a frame
+     *
+     * @param seq sequence number
+     * @retval 0 Success
+     * @retval <0 output error
+     */
+    int begin(uint16_t seq);
+
+    /** Add payload to the frame
+     *
+     * @param data Pointer of payload
+     * @param size Size of payload
+     * @retval 0 Success
+     * @retval <0 output error
+     */
+    int write(const void *data, uint32_t size);
+
+    /** Finish the frame (CRC and END) and flush
+     *
+     * @retval 0 Success
+     * @retval <0 output error (also from an earlier call)
+     */
+    int end();
+
+private:
+    void put(uint8_t c);
+    void put_escaped(uint8_t c);
+    void flush();
+
+    Output   _out;
+    void     *_ctx;
+    uint16_t _crc;
+    int      _err;
+    uint32_t _n;
+    uint8_t  _stage[FLUENT_FRAME_STAGE_SIZE];
+};
+
+/** Frame decoder
+ *
+ */
+class FluentFrameDecoder {
+public:
+    /** Create frame decoder
+     *
+     * @param buf buffer for one decoded frame
+     * @param size buffer length (largest payload + 4)
+     */
+    FluentFrameDecoder(uint8_t *buf, uint32_t size);
+
+    /** Feed received bytes
+     *
+     * Stops after the first complete frame; call again with the
+     * remaining bytes.
+     *
+     * @param data Pointer of received bytes
+     * @param size Size of received bytes
+     * @param frame set to true when a valid frame is complete
+     * @return number of bytes consumed
+     */
+    uint32_t feed(const uint8_t *data, uint32_t size, bool *frame);
+
+    /** Get sequence number of the last frame
+     */
+    inline uint16_t get_seq() const { return _seq; }
+
+    /** Get payload of the last frame
+     */
+    inline const uint8_t *get_payload() const { return _buf + 2; }
+
+    /** Get payload size of the last frame
+     */
+    inline uint32_t get_size() const { return _len; }
+
+    /** Get number of frames dropped (CRC error, overflow, truncated)
+     */
+    inline uint32_t get_errors() const { return _errors; }
+
+private:
+    uint8_t  *_buf;
+    uint32_t _nbuf;
+    uint32_t _ptr;
+    bool     _esc;
+    bool     _overflow;
+    uint16_t _seq;
+    uint32_t _len;
+    uint32_t _errors;
+};
+
+#endif // FLUENT_FRAME_H
@@ -16,6 +16,7 @@
 
 #include "mbed.h"
 #include "FluentLogger.h"
+#include "FluentFrame.h"
 #include "mbed_trace.h"
 #ifdef USE_NTP
 #include <time.h>
@@ -23,200 +24,931 @@
 
 #define TRACE_GROUP "FLUENTLOGGER"
 
+#define RETAINED_MAGIC 0x464c5452 // "FLTR"
+
+/* Holds the logger and marks it busy for the duration of a public call (nests) */
+class BusyScope {
+public:
+    BusyScope(FluentLogger &logger, bool &busy) : _logger(logger), _busy(busy)
+    {
+        _logger.lock();
+        _outer = _busy;
+        _busy = true;
+    }
+    ~BusyScope()
+    {
+        _busy = _outer;
+        _logger.unlock();
+    }
+private:
+    FluentLogger &_logger;
+    bool &_busy;
+    bool _outer;
+};
+
+FluentLogger::FluentLogger(uMP *mp, FluentTransport *transport, bool own_transport, NetworkInterface* aNetwork, const char *host, const int port) :
+_net(aNetwork), _transport(transport), _auth(NULL), _own_transport(own_transport), _no_heap(false), _persistent(true), _busy(false),
+_rt(NSAPI_ERROR_OK), _host(host), _port(port), _timeout(1000), _mp(mp), _batch_bytes(0), _nrecords(0),
+_flush_interval(0), _first_at(0), _min_batch(0), _max_batch(0), _max_latency(0), _stats(),
+_high_bytes(0), _low_bytes(0), _congested(false), _retained(NULL),
+_health_interval(0), _checked_at(0), _probe(NULL), _probe_misses(0), _max_misses(FLUENT_LOGGER_PROBE_MISSES), _probe_sent(false),
+_naddr(0), _addr_idx(0), _resolved_at(0), _dns_ttl(FLUENT_LOGGER_DNS_TTL_MS),
+_level(FLUENT_LEVEL_DEBUG), _level_floor(FLUENT_LEVEL_DEBUG), _level_ceiling(FLUENT_LEVEL_DEBUG), _ntag_levels(0),
+_ntags(0), _tag_pool_used(0)
+{
+}
+
 FluentLogger::FluentLogger(NetworkInterface* aNetwork, const char *host, const int port, uint32_t bufsize) :
-_sock(), _host(host), _port(port), _timeout(1000)
+FluentLogger(new uMP(bufsize), new FluentTCPTransport(aNetwork), true, aNetwork, host, port)
 {
-    _mp = new uMP(bufsize);
-    _sock = new TCPSocket();
-    _net = aNetwork;
-    _socket_is_tls = false;
+    _persistent = false;
 }
 
 FluentLogger::FluentLogger(NetworkInterface* aNetwork, const char* ssl_ca_pem, const char *host, const int port, uint32_t bufsize) :
-_sock(), _host(host), _port(port), _timeout(1000)
+FluentLogger(new uMP(bufsize), new FluentTLSTransport(aNetwork, ssl_ca_pem, host), true, aNetwork, host, port)
 {
-    _mp = new uMP(bufsize);
-    _sock = new TLSSocket();
-    _net = aNetwork;
-    _socket_is_tls = true;
-    ((TLSSocket*)_sock)->set_root_ca_cert(ssl_ca_pem);
+    // stays persistent, a TLS handshake per message is too expensive
 }
 
-int FluentLogger::close()
+FluentLogger::FluentLogger(FluentTransport *transport, NetworkInterface* aNetwork, const char *host, const int port, uint32_t bufsize) :
+FluentLogger(new uMP(bufsize), transport, false, aNetwork, host, port)
+{
+}
+
+FluentLogger::FluentLogger(FluentTransport &transport, uMP &mp, NetworkInterface* aNetwork, const char *host, const int port) :
+FluentLogger(&mp, &transport, false, aNetwork, host, port)
+{
+    _no_heap = true;
+}
+
+FluentLogger::~FluentLogger()
+{
+    if (_transport->is_connected()) {
+        _transport->close();
+    }
+    if (_own_transport) {
+        delete _transport;
+    }
+    if (!_no_heap) {
+        delete _mp;
+    }
+}
+
+bool FluentLogger::is_busy() const
+{
+#if MBED_CONF_RTOS_PRESENT
+    // _busy belongs to the thread holding the logger
+    return _mutex.get_owner() == ThisThread::get_id() && _busy;
+#else
+    return _busy;
+#endif
+}
+
+void FluentLogger::lock()
+{
+#if MBED_CONF_RTOS_PRESENT
+    _mutex.lock();
+#endif
+}
+
+bool FluentLogger::trylock()
+{
+#if MBED_CONF_RTOS_PRESENT
+    return _mutex.trylock();
+#else
+    return true;
+#endif
+}
+
+void FluentLogger::unlock()
+{
+#if MBED_CONF_RTOS_PRESENT
+    _mutex.unlock();
+#endif
+}
+
+void FluentLogger::set_persistent(bool persistent)
+{
+    _persistent = persistent;
+}
+
+void FluentLogger::set_auth(FluentAuth *auth)
+{
+    _auth = auth;
+    if (_auth) {
+        _persistent = true;
+    }
+}
+
+void FluentLogger::set_level(uint8_t level)
+{
+    _level = level;
+    update_levels();
+}
+
+int FluentLogger::set_level(const char *tag, uint8_t level)
+{
+    int i;
+    for (i = 0; i < _ntag_levels; i++) {
+        if (strcmp(_tag_levels[i].tag, tag) == 0) {
+            break;
+        }
+    }
+    if (i == _ntag_levels) {
+        if (_ntag_levels == FLUENT_LOGGER_MAX_TAG_LEVELS) {
+            return -1;
+        }
+        _ntag_levels++;
+    }
+    _tag_levels[i].tag = tag;
+    _tag_levels[i].level = level;
+    update_levels();
+    return 0;
+}
+
+uint8_t FluentLogger::tag_level(const char *tag) const
+{
+    for (int i = 0; i < _ntag_levels; i++) {
+        if (_tag_levels[i].tag == tag || (tag && strcmp(_tag_levels[i].tag, tag) == 0)) {
+            return _tag_levels[i].level;
+        }
+    }
+    return _level;
+}
+
+void FluentLogger::update_levels()
+{
+    // anything below the lowest level is rejected and anything at or
+    // above the highest one accepted without a lookup
+    uint8_t floor = _level;
+    uint8_t ceiling = _level;
+    for (int i = 0; i < _ntag_levels; i++) {
+        if (_tag_levels[i].level < floor) {
+            floor = _tag_levels[i].level;
+        }
+        if (_tag_levels[i].level > ceiling) {
+            ceiling = _tag_levels[i].level;
+        }
+    }
+    _level_floor = floor;
+    _level_ceiling = ceiling;
+
+    for (int i = 0; i < _ntags; i++) {
+        _tags[i].level = tag_level(_tags[i].tag);
+    }
+}
+
+void FluentLogger::set_clock(mbed::Callback<uint64_t()> clock)
+{
+    _clock = clock;
+}
+
+uint64_t FluentLogger::get_time_ms() const
+{
+    if (_clock) {
+        return _clock();
+    }
+    return Kernel::get_ms_count();
+}
+
+void FluentLogger::set_dns_ttl(uint32_t ttl_ms)
+{
+    _dns_ttl = ttl_ms;
+}
+
+void FluentLogger::flush_dns()
 {
+    _naddr = 0;
+}
+
+int FluentLogger::resolve()
+{
+    if (_no_heap) {
+        // getaddrinfo() allocates the result list, a single lookup does not
+        nsapi_error_t err = _net->gethostbyname(_host, &_addr[0]);
+        if (err != NSAPI_ERROR_OK) {
+            tr_debug("Could not resolve %s (%d)", _host, err);
+            _naddr = 0;
+            return err;
+        }
+        _addr[0].set_port(_port);
+        _naddr = 1;
+        _addr_idx = 0;
+        _resolved_at = get_time_ms();
+        return NSAPI_ERROR_OK;
+    }
 
-    if(_socket_is_tls){
-        _rt = ((TLSSocket*)_sock)->close();
+    SocketAddress hints;
+    SocketAddress *res = NULL;
+
+    nsapi_size_or_error_t n = _net->getaddrinfo(_host, &hints, &res);
+    if (n <= 0) {
+        tr_debug("Could not resolve %s (%d)", _host, n);
+        _naddr = 0;
+        return (n < 0) ? n : NSAPI_ERROR_DNS_FAILURE;
+    }
+    if (n > FLUENT_LOGGER_MAX_ADDRESSES) {
+        n = FLUENT_LOGGER_MAX_ADDRESSES;
+    }
+    for (int i = 0; i < n; i++) {
+        _addr[i] = res[i];
+        _addr[i].set_port(_port);
+    }
+    delete[] res;
+
+    _naddr = n;
+    _addr_idx = 0;
+    _resolved_at = get_time_ms();
+    tr_debug("Resolved %s to %d address(es)", _host, _naddr);
+    return NSAPI_ERROR_OK;
+}
+
+int FluentLogger::connect()
+{
+    if ((_transport->capabilities() & FluentTransport::CAP_ADDRESS) == 0) {
+        return _transport->connect(SocketAddress());
+    }
+
+    if (_naddr == 0 || (get_time_ms() - _resolved_at) >= _dns_ttl) {
+        _rt = resolve();
         if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not close() TLS Socket (%d)", _rt);
             return _rt;
         }
     }
-    else{
-        _rt = ((TCPSocket*)_sock)->close();
+
+    for (int i = 0; i < _naddr; i++) {
+        _rt = _transport->connect(_addr[_addr_idx]);
+        if (_rt == NSAPI_ERROR_OK) {
+            return NSAPI_ERROR_OK;
+        }
+        tr_debug("Could not connect() to %s (%d)", _addr[_addr_idx].get_ip_address(), _rt);
+        _addr_idx = (_addr_idx + 1) % _naddr;
+
+        // a failed connect leaves the socket unusable, start over on a fresh one
+        _transport->close();
+        _transport->open();
+    }
+
+    // every cached address failed, look the name up again next time
+    _naddr = 0;
+    return _rt;
+}
+
+int FluentLogger::open()
+{
+    BusyScope busy(*this, _busy);
+    if (_transport->is_connected()) {
+        return NSAPI_ERROR_OK;
+    }
+    tr_debug("Transport Open");
+    _rt = _transport->open();
+    if (_rt != NSAPI_ERROR_OK) {
+        tr_debug("Could not open() transport (%d)", _rt);
+        return _rt;
+    }
+    tr_debug("Transport Connect");
+    _rt = connect();
+    if (_rt != NSAPI_ERROR_OK) {
+        tr_debug("Could not connect() transport (%d)", _rt);
+        _transport->close();
+        return _rt;
+    }
+    if (_auth) {
+        tr_debug("Transport Handshake");
+        _transport->set_timeout(_timeout);
+        _rt = _auth->handshake(_transport);
+        _transport->set_timeout(-1);
         if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not close() TCP Socket (%d)", _rt);
+            tr_debug("Handshake failed (%d)", _rt);
+            _transport->close();
             return _rt;
         }
     }
+    return _rt;
+}
 
-    // delete _sock;
-    // _sock = NULL;
+int FluentLogger::close()
+{
+    BusyScope busy(*this, _busy);
+    _rt = _transport->close();
+    if (_rt != NSAPI_ERROR_OK) {
+        tr_debug("Could not close() transport (%d)", _rt);
+    }
     return _rt;
 }
 
 int FluentLogger::log(const char *tag, const char *msg)
 {
-    // if(_socket_is_tls){
-    //     nsapi_error_t rt = ((TLSSocket*)_sock)->open(_net);
-    //     if (rt != NSAPI_ERROR_OK) {
-    //         tr_debug("\r\nCould not open() TCP Socket (%d)\r\n", rt);
-    //         return rt;
-    //     }
-    //     rt = ((TLSSocket*)_sock)->connect(_host, _port);
-    //     if (rt != NSAPI_ERROR_OK) {
-    //         tr_debug("\r\nCould not connect() TCP socket (%d)\r\n", rt);
-    //         return rt;
-    //     }
-    // }
-    // else{
-    //     nsapi_error_t rt = ((TCPSocket*)_sock)->open(_net);
-    //     if (rt != NSAPI_ERROR_OK) {
-    //         tr_debug("\r\nCould not open() TCP Socket (%d)\r\n", rt);
-    //         return rt;
-    //     }
-    //     rt = ((TCPSocket*)_sock)->connect(_host, _port);
-    //     if (rt != NSAPI_ERROR_OK) {
-    //         tr_debug("\r\nCould not connect() TCP socket (%d)\r\n", rt);
-    //         return rt;
-    //     }
-    // }
+    BusyScope busy(*this, _busy);
+    uint32_t mark = _mp->get_size();
+    while (!start_message(tag) || !_mp->set_str(msg, strlen(msg))) {
+        if (!retry_message(mark)) {
+            return -1;
+        }
+    }
+    return end_message();
+}
 
-    _mp->init();
+int FluentLogger::logf(const char *tag, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vlogf(tag, fmt, ap);
+    va_end(ap);
+    return ret;
+}
 
-//     // tag, timestamp, message
-//     if (!_mp->start_array(3)) {
-//         return -1;
-//     }
-//     if (!_mp->set_str(tag, strlen(tag))) {
-//         return -1;
-//     }
-// #ifdef USE_NTP  
-//     if (!_mp->set_u32(time(NULL))) {
-//         return -1;
-//     }
-// #else
-//     if (!_mp->set_u32(0)) {
-//         return -1;
-//     }
-// #endif
-//     if (!_mp->set_str(msg, strlen(msg))) {
-//         return -1;
-//     }
-        // tag, timestamp, message
-    if (!_mp->start_array(3)) {
-        return -1;
+int FluentLogger::vlogf(const char *tag, const char *fmt, va_list ap)
+{
+    BusyScope busy(*this, _busy);
+    uint32_t mark = _mp->get_size();
+    for (;;) {
+        va_list aq;
+        va_copy(aq, ap);
+        bool ok = start_message(tag) && _mp->set_vstrf(fmt, aq);
+        va_end(aq);
+        if (ok) {
+            break;
+        }
+        if (!retry_message(mark)) {
+            return -1;
+        }
     }
-    if (!_mp->set_str(tag, strlen(tag))) {
+    return end_message();
+}
+
+int FluentLogger::log(const char *tag, uMP &mpmsg)
+{
+    BusyScope busy(*this, _busy);
+    if (can_send_direct()) {
+        if (!start_message(tag)) {
+            _mp->init();
+            _stats.records_dropped++;
+            return -1;
+        }
+        return send_direct(mpmsg);
+    }
+    uint32_t mark = _mp->get_size();
+    while (!start_message(tag) || !_mp->set_raw((const char*)mpmsg.get_buffer(), mpmsg.get_size())) {
+        if (!retry_message(mark)) {
+            return -1;
+        }
+    }
+    return end_message();
+}
+
+int FluentLogger::register_tag(const char *tag)
+{
+    BusyScope busy(*this, _busy);
+    for (int i = 0; i < _ntags; i++) {
+        if (_tags[i].tag == tag || strcmp(_tags[i].tag, tag) == 0) {
+            return i;
+        }
+    }
+    if (_ntags == FLUENT_LOGGER_MAX_TAGS) {
         return -1;
     }
-    if (!_mp->set_u32(0)) {
+
+    // tag, timestamp placeholder
+    uMP header(_tag_pool + _tag_pool_used, FLUENT_LOGGER_TAG_POOL_SIZE - _tag_pool_used);
+    if (!header.start_array(3) || !header.set_str(tag, strlen(tag)) || !header.set_u32(0)) {
         return -1;
     }
-    if (!_mp->set_str(msg, strlen(msg))) {
-        
+    _tags[_ntags].tag = tag;
+    _tags[_ntags].offset = _tag_pool_used;
+    _tags[_ntags].size = header.get_size();
+    _tags[_ntags].level = tag_level(tag);
+    _tag_pool_used += header.get_size();
+    return _ntags++;
+}
+
+int FluentLogger::log(int tag, const char *msg)
+{
+    BusyScope busy(*this, _busy);
+    if (tag < 0 || tag >= _ntags) {
         return -1;
     }
-    return(send());
+    uint32_t mark = _mp->get_size();
+    while (!start_message(tag) || !_mp->set_str(msg, strlen(msg))) {
+        if (!retry_message(mark)) {
+            return -1;
+        }
+    }
+    return end_message();
 }
 
-int FluentLogger::log(const char *tag, uMP &mpmsg)
+int FluentLogger::logf(int tag, const char *fmt, ...)
 {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vlogf(tag, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int FluentLogger::vlogf(int tag, const char *fmt, va_list ap)
+{
+    BusyScope busy(*this, _busy);
+    if (tag < 0 || tag >= _ntags) {
+        return -1;
+    }
+    uint32_t mark = _mp->get_size();
+    for (;;) {
+        va_list aq;
+        va_copy(aq, ap);
+        bool ok = start_message(tag) && _mp->set_vstrf(fmt, aq);
+        va_end(aq);
+        if (ok) {
+            break;
+        }
+        if (!retry_message(mark)) {
+            return -1;
+        }
+    }
+    return end_message();
+}
 
-    // nsapi_error_t rt = _sock->open(_net);
-    // if (rt != NSAPI_ERROR_OK) {
-    //     tr_debug("\r\nCould not open TCP Socket (%d)\r\n", rt);
-    //     return -1;
-    // }
-    // rt = _sock->connect(_host, _port);
-    // if (rt != NSAPI_ERROR_OK) {
-    //     tr_debug("Could not connect TCP socket (%d)\r\n", rt);
-    //     return -1;
-    // }
+int FluentLogger::log(int tag, uMP &mpmsg)
+{
+    BusyScope busy(*this, _busy);
+    if (tag < 0 || tag >= _ntags) {
+        return -1;
+    }
+    if (can_send_direct()) {
+        if (!start_message(tag)) {
+            _mp->init();
+            _stats.records_dropped++;
+            return -1;
+        }
+        return send_direct(mpmsg);
+    }
+    uint32_t mark = _mp->get_size();
+    while (!start_message(tag) || !_mp->set_raw((const char*)mpmsg.get_buffer(), mpmsg.get_size())) {
+        if (!retry_message(mark)) {
+            return -1;
+        }
+    }
+    return end_message();
+}
 
-    _mp->init();
+bool FluentLogger::start_message(int tag)
+{
+    if (!_mp->set_raw((const char*)_tag_pool + _tags[tag].offset, _tags[tag].size)) {
+        return false;
+    }
+#ifdef USE_NTP
+    // patch the u32 timestamp at the end of the cached header
+    uint32_t now = time(NULL);
+    uint8_t *p = _mp->get_buffer() + _mp->get_size() - 4;
+    p[0] = now >> 24;
+    p[1] = now >> 16;
+    p[2] = now >> 8;
+    p[3] = now;
+#endif
+    return true;
+}
 
+bool FluentLogger::start_message(const char *tag)
+{
     // tag, timestamp, message
     if (!_mp->start_array(3)) {
-        return -1;
+        return false;
     }
     if (!_mp->set_str(tag, strlen(tag))) {
-        return -1;
+        return false;
+    }
+#ifdef USE_NTP
+    return _mp->set_u32(time(NULL));
+#else
+    return _mp->set_u32(0);
+#endif
+}
+
+int FluentLogger::end_message()
+{
+    if (_nrecords++ == 0) {
+        _first_at = get_time_ms();
+    }
+    commit_retained();
+    check_watermarks();
+    if (_mp->get_size() >= _batch_bytes) {
+        return flush();
     }
-#ifdef USE_NTP  
-    if (!_mp->set_u32(time(NULL))) {
+    return flush_due();
+}
+
+bool FluentLogger::retry_message(uint32_t &mark)
+{
+    _mp->rewind(mark);
+    if (mark == 0) {
+        // does not fit even into an empty buffer
+        _stats.records_dropped++;
+        return false;
+    }
+    if (flush() != 0) {
+        _stats.records_dropped++;
+        return false;
+    }
+    mark = 0;
+    return true;
+}
+
+void FluentLogger::set_batch(uint32_t bytes)
+{
+    _batch_bytes = bytes;
+}
+
+void FluentLogger::set_flush_interval(uint32_t ms)
+{
+    _flush_interval = ms;
+}
+
+int FluentLogger::set_adaptive(uint32_t min_bytes, uint32_t max_bytes, uint32_t max_latency_ms)
+{
+    if (max_latency_ms && min_bytes > max_bytes) {
         return -1;
     }
-#else
-    if (!_mp->set_u32(0)) {
+    _min_batch = min_bytes;
+    _max_batch = max_bytes;
+    _max_latency = max_latency_ms;
+    if (_max_latency) {
+        // start small until the link has been measured; an interval
+        // of 0 would mean no time limit at all
+        _batch_bytes = _min_batch;
+        _flush_interval = _max_latency > 1 ? _max_latency / 2 : 1;
+    }
+    return 0;
+}
+
+int FluentLogger::poll()
+{
+    BusyScope busy(*this, _busy);
+    if (_health_interval && (get_time_ms() - _checked_at) >= _health_interval) {
+        _checked_at = get_time_ms();
+        int rt = check_health();
+        if (rt < 0) {
+            return rt;
+        }
+    }
+    return flush_due();
+}
+
+void FluentLogger::set_health_check(uint32_t interval_ms, FluentTransport *probe, int misses)
+{
+    _health_interval = interval_ms;
+    _probe = probe;
+    _max_misses = misses;
+    _probe_misses = 0;
+    _probe_sent = false;
+    _checked_at = get_time_ms();
+}
+
+int FluentLogger::check_health()
+{
+    if (!_transport->is_connected()) {
+        // nothing to watch, the next send connects
+        return NSAPI_ERROR_OK;
+    }
+
+    bool alive = true;
+    if (_transport->capabilities() & FluentTransport::CAP_STREAM) {
+        // no acks are requested, so the server sends nothing by itself:
+        // 0 is a close, an error a reset, data is unexpected and dropped
+        uint8_t buf[16];
+        _transport->set_timeout(0);
+        nsapi_size_or_error_t n = _transport->recv(buf, sizeof(buf));
+        _transport->set_timeout(-1);
+        if (n == 0 || (n < 0 && n != NSAPI_ERROR_WOULD_BLOCK)) {
+            tr_debug("Connection closed by server (%d)", n);
+            alive = false;
+        } else if (n > 0) {
+            tr_debug("Dropped %d unexpected byte(s) from server", n);
+        }
+    }
+    if (alive && _probe && _naddr > 0) {
+        alive = probe();
+    }
+    if (alive) {
+        return NSAPI_ERROR_OK;
+    }
+
+    _stats.failovers++;
+    close();
+    if (_naddr > 0) {
+        _addr_idx = (_addr_idx + 1) % _naddr;
+    }
+    _probe_misses = 0;
+    _probe_sent = false;
+    return open();
+}
+
+bool FluentLogger::probe()
+{
+    // fluentd answers any datagram on its forward port. The answer is
+    // not waited for: the heartbeat of the previous check has had a whole
+    // interval to be answered, so poll() does not block on the probe.
+    if (!_probe->is_connected() && _probe->open() != NSAPI_ERROR_OK) {
+        _probe_sent = false;
+        return ++_probe_misses < _max_misses;
+    }
+    nsapi_error_t rt = _probe->connect(_addr[_addr_idx]);
+    if (rt != NSAPI_ERROR_OK) {
+        tr_debug("Could not connect() probe to %s (%d)", _addr[_addr_idx].get_ip_address(), rt);
+        _probe->close();
+        _probe_sent = false;
+        return ++_probe_misses < _max_misses;
+    }
+
+    uint8_t ping = 0;
+    bool answered = false;
+    _probe->set_timeout(0);
+    // one heartbeat per check, so at most misses + 1 answers are waiting
+    for (int i = 0; i <= _max_misses && _probe->recv(&ping, 1) >= 0; i++) {
+        answered = true;    // late answers to earlier heartbeats count as well
+    }
+    if (_probe_sent && answered) {
+        _probe_misses = 0;
+    } else if (_probe_sent) {
+        tr_debug("Heartbeat to %s not answered", _addr[_addr_idx].get_ip_address());
+        _probe_misses++;
+    }
+    ping = 0;
+    _probe_sent = _probe->send(&ping, 1) == 1;
+    if (!_probe_sent) {
+        tr_debug("Heartbeat to %s not sent", _addr[_addr_idx].get_ip_address());
+        _probe_misses++;
+    }
+    return _probe_misses < _max_misses;
+}
+
+int FluentLogger::flush_due()
+{
+    if (_nrecords == 0 || _flush_interval == 0) {
+        return 0;
+    }
+    if ((get_time_ms() - _first_at) < _flush_interval) {
+        return 0;
+    }
+    return flush();
+}
+
+uint32_t FluentLogger::get_drain_ms() const
+{
+    if (_mp->get_size() == 0) {
+        return 0;
+    }
+    if (_stats.throughput == 0) {
+        return UINT32_MAX;
+    }
+    return (uint32_t)(((uint64_t)_mp->get_size() * 1000) / _stats.throughput);
+}
+
+int FluentLogger::set_watermarks(uint32_t high_bytes, uint32_t low_bytes, mbed::Callback<void(bool)> cb)
+{
+    if (cb && low_bytes >= high_bytes) {
         return -1;
     }
-#endif
-    if (!_mp->set_raw((const char*)mpmsg.get_buffer(), mpmsg.get_size())) {
+    _high_bytes = high_bytes;
+    _low_bytes = low_bytes;
+    _on_watermark = cb;
+    _congested = false;
+    return 0;
+}
+
+void FluentLogger::check_watermarks()
+{
+    if (!_on_watermark) {
+        return;
+    }
+    uint32_t size = _mp->get_size();
+    if (!_congested && size >= _high_bytes) {
+        _congested = true;
+        _on_watermark(true);
+    } else if (_congested && size <= _low_bytes) {
+        _congested = false;
+        _on_watermark(false);
+    }
+}
+
+int FluentLogger::set_retained(void *region, uint32_t size)
+{
+    BusyScope busy(*this, _busy);
+    if (size <= sizeof(RetainedHeader)) {
         return -1;
     }
-    return(send());
+    RetainedHeader *hdr = (RetainedHeader *)region;
+    uint8_t *buf = (uint8_t *)region + sizeof(RetainedHeader);
+    uint32_t capacity = size - sizeof(RetainedHeader);
+
+    // the active slot, or the previous one if the reset hit the data
+    uint32_t length = 0;
+    uint32_t records = 0;
+    if (hdr->magic == RETAINED_MAGIC && hdr->capacity == capacity && hdr->active < 2) {
+        for (int i = 0; i < 2; i++) {
+            int s = (hdr->active + i) % 2;
+            uint32_t len = hdr->slot[s].length;
+            if (len <= capacity && fluent_crc16(0xffff, buf, len) == hdr->slot[s].crc) {
+                length = len;
+                records = hdr->slot[s].records;
+                break;
+            }
+        }
+    }
+    tr_debug("Recovered %lu message(s) from retained memory", (unsigned long)records);
+
+    _mp->attach(buf, capacity);
+    _mp->resume(length);
+    _nrecords = records;
+    _first_at = get_time_ms();
+
+    hdr->magic = RETAINED_MAGIC;
+    hdr->capacity = capacity;
+    hdr->active = 0;
+    hdr->slot[0].length = length;
+    hdr->slot[0].records = records;
+    hdr->slot[0].crc = fluent_crc16(0xffff, buf, length);
+    hdr->slot[1] = hdr->slot[0];
+    _retained = hdr;
+    return records;
+}
+
+void FluentLogger::commit_retained()
+{
+    if (_retained == NULL) {
+        return;
+    }
+    uint32_t cur = _retained->active;
+    uint32_t next = cur ^ 1;
+    uint32_t length = _mp->get_size();
+    uint32_t crc = 0xffff;
+    if (length >= _retained->slot[cur].length) {
+        // only the bytes appended since the last commit are new
+        crc = _retained->slot[cur].crc;
+        crc = fluent_crc16(crc, _mp->get_buffer() + _retained->slot[cur].length, length - _retained->slot[cur].length);
+    } else {
+        crc = fluent_crc16(crc, _mp->get_buffer(), length);
+    }
+    _retained->slot[next].length = length;
+    _retained->slot[next].records = _nrecords;
+    _retained->slot[next].crc = crc;
+    _retained->active = next;
 }
 
-int FluentLogger::send()
+FluentLogger::Stats FluentLogger::get_stats() const
 {
-    if(_socket_is_tls){
-        tr_debug("Socket Open TLS");
-        _rt = ((TLSSocket*)_sock)->open(_net);
-        if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not open() TLS Socket (%d)", _rt);
-            // _rt = close();
-            // return _rt;
+    Stats stats = _stats;
+    stats.batch_bytes = _batch_bytes;
+    stats.flush_interval_ms = _flush_interval;
+    return stats;
+}
+
+void FluentLogger::update_stats(uint32_t bytes, uint32_t ms)
+{
+    _stats.last_send_ms = ms;
+    if (bytes == 0) {
+        _stats.send_errors++;
+        if (_max_latency) {
+            // back off on a failing link, smaller batches get through sooner
+            _batch_bytes /= 2;
+            if (_batch_bytes < _min_batch) {
+                _batch_bytes = _min_batch;
+            }
         }
-        tr_debug("Socket Connect TLS");
-        _rt = ((TLSSocket*)_sock)->connect(_host, _port);
-        if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not connect() TLS socket (%d)", _rt);
-            // _rt = close();
-            // return _rt;
-        }
-        tr_debug("Socket Send TLS");
-        // _sock->set_blocking(false);
-        _rt = ((TLSSocket*)_sock)->send((char*)_mp->get_buffer(), (int)_mp->get_size());
-        // if ( _rt != NSAPI_ERROR_OK ) {//fail
-        //     tr_debug("\r\nCould not send() TLS socket (%d)\r\n", _rt);
-        //     _rt = close();
-        //     return(_rt);
-        // }
-    }
-    else{
-        tr_debug("Socket Open TCP");
-        _rt = ((TCPSocket*)_sock)->open(_net);
-        if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not open() TCP Socket (%d)", _rt);
-            return _rt;
+        return;
+    }
+    _stats.sends++;
+    _stats.records_sent += _nrecords;
+    _stats.bytes_sent += bytes;
+
+    // moving average over roughly the last four sends
+    uint32_t rate = (uint32_t)(((uint64_t)bytes * 1000) / (ms ? ms : 1));
+    if (_stats.throughput == 0) {
+        _stats.throughput = rate;
+        _stats.send_ms = ms;
+    } else {
+        _stats.throughput = _stats.throughput - _stats.throughput / 4 + rate / 4;
+        _stats.send_ms = _stats.send_ms - _stats.send_ms / 4 + ms / 4;
+    }
+    if (_max_latency == 0) {
+        return;
+    }
+
+    // transmit for at most half of the bound; as the rate includes the
+    // connect cost this settles where a send takes half the bound
+    uint64_t batch = ((uint64_t)_stats.throughput * _max_latency) / 2000;
+    if (batch < _min_batch) {
+        batch = _min_batch;
+    }
+    if (batch > _max_batch) {
+        batch = _max_batch;
+    }
+    _batch_bytes = (uint32_t)batch;
+
+    // wait for the rest, but never degrade into a send per record
+    uint32_t floor = _max_latency > 3 ? _max_latency / 4 : 1;
+    _flush_interval = (_stats.send_ms + floor < _max_latency) ? _max_latency - _stats.send_ms : floor;
+}
+
+int FluentLogger::flush()
+{
+    BusyScope busy(*this, _busy);
+    if (_mp->get_size() == 0) {
+        return 0;
+    }
+    FluentIovec iov = { _mp->get_buffer(), _mp->get_size() };
+    uint64_t start = get_time_ms();
+    int rt = send(&iov, 1);
+    uint32_t elapsed = (uint32_t)(get_time_ms() - start);
+    if (rt < 0) {
+        update_stats(0, elapsed);
+        tr_debug("Keeping %lu message(s) for next flush", (unsigned long)_nrecords);
+        return rt;
+    }
+    update_stats(_mp->get_size(), elapsed);
+    _mp->init();
+    _nrecords = 0;
+    commit_retained();
+    check_watermarks();
+    return 0;
+}
+
+bool FluentLogger::can_send_direct() const
+{
+    // a framing transport needs both buffers in one write, a stream
+    // that takes buffers as they are gets the same bytes from two
+    uint32_t caps = _transport->capabilities();
+    bool no_copy = (caps & FluentTransport::CAP_GATHER)
+                   || ((caps & FluentTransport::CAP_STREAM) && (caps & FluentTransport::CAP_ZERO_COPY));
+    return no_copy && _batch_bytes == 0 && _nrecords == 0 && _retained == NULL;
+}
+
+int FluentLogger::send_direct(uMP &mpmsg)
+{
+    // the header is the only thing in the (empty) message buffer
+    FluentIovec iov[2] = {
+        { _mp->get_buffer(), _mp->get_size() },
+        { mpmsg.get_buffer(), mpmsg.get_size() }
+    };
+    uint32_t size = _mp->get_size() + mpmsg.get_size();
+    uint64_t start = get_time_ms();
+    int rt = send(iov, 2);
+    uint32_t elapsed = (uint32_t)(get_time_ms() - start);
+    if (rt < 0) {
+        update_stats(0, elapsed);
+        // keep it like a batched message, if it fits
+        if (!_mp->set_raw((const char*)mpmsg.get_buffer(), mpmsg.get_size())) {
+            _mp->init();
+            _stats.records_dropped++;
+            return rt;
         }
-        tr_debug("Socket Connect TCP");
-        _rt = ((TCPSocket*)_sock)->connect(_host, _port);
-        if (_rt != NSAPI_ERROR_OK) {
-            tr_debug("Could not connect() TCP socket (%d)", _rt);
-            return _rt;
+        _nrecords = 1;
+        _first_at = get_time_ms();
+        check_watermarks();
+        return rt;
+    }
+    _nrecords = 1;
+    update_stats(size, elapsed);
+    _nrecords = 0;
+    _mp->init();
+    return 0;
+}
+
+int FluentLogger::send(FluentIovec *iov, int iovcnt)
+{
+    _rt = open();
+    if (_rt != NSAPI_ERROR_OK) {
+        return _rt;
+    }
+
+    tr_debug("Transport Send");
+    bool gather = (_transport->capabilities() & FluentTransport::CAP_GATHER) != 0;
+    while (iovcnt > 0) {
+        if (gather) {
+            _rt = _transport->sendv(iov, iovcnt);
+        } else {
+            _rt = _transport->send(iov->data, iov->size);
         }
-        tr_debug("Socket Send TCP");
-        // _sock->set_blocking(false);
-        _rt = ((TCPSocket*)_sock)->send((char*)_mp->get_buffer(), (int)_mp->get_size());
-        if ( _rt<0 && _rt != NSAPI_ERROR_OK ) {//fail
-            tr_debug("Socket Send failed, closing TLS socket");
-            _rt = close();
-            return(_rt);
+        if (_rt < 0) {
+            tr_debug("Transport Send failed (%d), closing", _rt);
+            nsapi_error_t err = _rt;
+            close();
+            return(err);
         }
+        // skip what was sent, a short write continues mid-buffer
+        uint32_t sent = _rt;
+        while (iovcnt > 0 && sent >= iov->size) {
+            sent -= iov->size;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->data = (const uint8_t *)iov->data + sent;
+            iov->size -= sent;
+        }
+    }
+
+    if (!_persistent || (_auth && !_auth->keepalive())) {
         _rt = close();
     }
-    // _rt = close();
-    return(_rt);
+    return NSAPI_ERROR_OK;
 }
@@ -17,12 +17,110 @@
 #ifndef FLUENT_LOGGER_MBED_H
 #define FLUENT_LOGGER_MBED_H
 #include "mbed.h"
-#include "TCPSocket.h"
-#include "TLSSocket.h"
+#include "FluentTransport.h"
+#include "FluentAuth.h"
 #include "uMP.h"
 
+/** How long a resolved fluentd address is reused before a new lookup (ms) */
+#ifndef FLUENT_LOGGER_DNS_TTL_MS
+#define FLUENT_LOGGER_DNS_TTL_MS    (10 * 60 * 1000)
+#endif
+
+/** Maximum number of resolved fluentd addresses kept for failover */
+#ifndef FLUENT_LOGGER_MAX_ADDRESSES
+#define FLUENT_LOGGER_MAX_ADDRESSES 4
+#endif
+
+/** Maximum number of per-tag level overrides */
+#ifndef FLUENT_LOGGER_MAX_TAG_LEVELS
+#define FLUENT_LOGGER_MAX_TAG_LEVELS 8
+#endif
+
+/** Unanswered heartbeats before a server is given up */
+#ifndef FLUENT_LOGGER_PROBE_MISSES
+#define FLUENT_LOGGER_PROBE_MISSES  3
+#endif
+
+/** Maximum number of registered tags */
+#ifndef FLUENT_LOGGER_MAX_TAGS
+#define FLUENT_LOGGER_MAX_TAGS      16
+#endif
+
+/** Bytes shared by the pre-encoded headers of registered tags */
+#ifndef FLUENT_LOGGER_TAG_POOL_SIZE
+#define FLUENT_LOGGER_TAG_POOL_SIZE 256
+#endif
+
+/* Log levels */
+#define FLUENT_LEVEL_DEBUG  0
+#define FLUENT_LEVEL_INFO   1
+#define FLUENT_LEVEL_WARN   2
+#define FLUENT_LEVEL_ERROR  3
+#define FLUENT_LEVEL_NONE   4
+
+/** Lowest level compiled in; call sites below it are removed by the preprocessor */
+#ifndef FLUENT_LOG_MIN_LEVEL
+#define FLUENT_LOG_MIN_LEVEL FLUENT_LEVEL_DEBUG
+#endif
+
+/** Log a formatted message if the level is enabled at run time
+ *
+ * Arguments are not evaluated when the level is disabled.
+ */
+#define FLUENT_LOG_AT(logger, level, tag, ...) \
+    do { \
+        if ((logger).is_enabled((level), (tag))) { \
+            (logger).logf((tag), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if FLUENT_LOG_MIN_LEVEL <= FLUENT_LEVEL_DEBUG
+#define FLUENT_DEBUG(logger, tag, ...)  FLUENT_LOG_AT(logger, FLUENT_LEVEL_DEBUG, tag, __VA_ARGS__)
+#else
+#define FLUENT_DEBUG(logger, tag, ...)  do {} while (0)
+#endif
+
+#if FLUENT_LOG_MIN_LEVEL <= FLUENT_LEVEL_INFO
+#define FLUENT_INFO(logger, tag, ...)   FLUENT_LOG_AT(logger, FLUENT_LEVEL_INFO, tag, __VA_ARGS__)
+#else
+#define FLUENT_INFO(logger, tag, ...)   do {} while (0)
+#endif
+
+#if FLUENT_LOG_MIN_LEVEL <= FLUENT_LEVEL_WARN
+#define FLUENT_WARN(logger, tag, ...)   FLUENT_LOG_AT(logger, FLUENT_LEVEL_WARN, tag, __VA_ARGS__)
+#else
+#define FLUENT_WARN(logger, tag, ...)   do {} while (0)
+#endif
+
+#if FLUENT_LOG_MIN_LEVEL <= FLUENT_LEVEL_ERROR
+#define FLUENT_ERROR(logger, tag, ...)  FLUENT_LOG_AT(logger, FLUENT_LEVEL_ERROR, tag, __VA_ARGS__)
+#else
+#define FLUENT_ERROR(logger, tag, ...)  do {} while (0)
+#endif
+
+/** In-place storage of a StaticFluentLogger
+ *
+ * A base class so that it is constructed before the logger that uses it.
+ */
+template <uint32_t BUFSIZE, typename Transport>
+class StaticFluentLoggerStorage {
+protected:
+    StaticFluentLoggerStorage(NetworkInterface* aNetwork) :
+        _mp_storage(_buf_storage, BUFSIZE), _transport_storage(aNetwork)
+    {
+    }
+
+    uint8_t   _buf_storage[BUFSIZE];
+    uMP       _mp_storage;
+    Transport _transport_storage;
+};
+
 /** Fluent Logger for mbed
  *
+ * Logging, flush(), poll(), open() and close() may be called from
+ * several threads: each call holds the logger (see lock()) while it
+ * works on the message buffer and the connection. The set_xxx()
+ * functions are meant for start-up, before other threads log.
  */
 class FluentLogger {
 public:
@@ -42,6 +140,20 @@ public:
      */
     FluentLogger(NetworkInterface* aNetwork, const char* ssl_ca_pem, const char *host, const int port = 24224, uint32_t bufsize = 128);
 
+    /** Create a FluentLogger instance with a custom transport
+     *
+     * The connection is kept open between messages (see set_persistent()).
+     *
+     * @param transport transport to use, not owned by the logger
+     * @param aNetwork network interface used to resolve host (may be NULL without FluentTransport::CAP_ADDRESS)
+     * @param host fluentd server hostname/ipaddress (may be NULL without FluentTransport::CAP_ADDRESS)
+     * @param port fluentd server port (default: 24224)
+     * @param bufsize message buffer length (default: 128)
+     */
+    FluentLogger(FluentTransport *transport, NetworkInterface* aNetwork = NULL, const char *host = NULL, const int port = 24224, uint32_t bufsize = 128);
+
+    ~FluentLogger();
+
     /** Open connection (automatically called on log)
      *
      * @retval 0 Success
@@ -57,6 +169,9 @@ public:
     int close();
 
     /** Send simple string message to fluent server with tag.
+     *
+     * The log() and logf() calls carry no level and are always sent;
+     * the run time levels apply to the FLUENT_xxx macros.
      *
      * @param tag tag
      * @param msg null terminated string
@@ -65,7 +180,34 @@ public:
      */
     int log(const char *tag, const char *msg);
 
+    /** Send printf-style formatted message to fluent server with tag.
+     *
+     * The message is formatted directly into the send buffer.
+     *
+     * @param tag tag
+     * @param fmt printf format string
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int logf(const char *tag, const char *fmt, ...) MBED_PRINTF_METHOD(2, 3);
+
+    /** Send printf-style formatted message to fluent server with tag (va_list version).
+     *
+     * @param tag tag
+     * @param fmt printf format string
+     * @param ap argument list
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int vlogf(const char *tag, const char *fmt, va_list ap) MBED_PRINTF_METHOD(2, 0);
+
     /** Send MassagePacked message to fluent server with tag.
+     *
+     * Without batching and with a transport that gathers buffers
+     * (FluentTransport::CAP_GATHER) or a stream that sends them as they
+     * are (CAP_STREAM and CAP_ZERO_COPY), the message is sent straight
+     * from msg behind its header instead of being copied into the
+     * message buffer, so it may even be larger than the buffer.
      *
      * @param tag tag
      * @param msg MessagePacked message
@@ -74,24 +216,607 @@ public:
      */
     int log(const char *tag, uMP &msg);
 
+    /** Register a tag for repeated logging
+     *
+     * The message header (array, tag and timestamp) is encoded once, so
+     * logging with the handle costs a single copy plus the timestamp.
+     * The tag string is kept by reference and must stay valid.
+     * Registering the same tag again returns the same handle.
+     *
+     * @param tag tag
+     * @retval >=0 tag handle
+     * @retval -1 Failure (too many tags or tag pool full)
+     */
+    int register_tag(const char *tag);
+
+    /** Send simple string message with a registered tag.
+     *
+     * @param tag tag handle from register_tag()
+     * @param msg null terminated string
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int log(int tag, const char *msg);
+
+    /** Send printf-style formatted message with a registered tag.
+     *
+     * @param tag tag handle from register_tag()
+     * @param fmt printf format string
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int logf(int tag, const char *fmt, ...) MBED_PRINTF_METHOD(2, 3);
+
+    /** Send printf-style formatted message with a registered tag (va_list version).
+     *
+     * @param tag tag handle from register_tag()
+     * @param fmt printf format string
+     * @param ap argument list
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int vlogf(int tag, const char *fmt, va_list ap) MBED_PRINTF_METHOD(2, 0);
+
+    /** Send MassagePacked message with a registered tag.
+     *
+     * Sent without a copy like log(const char *, uMP &).
+     *
+     * @param tag tag handle from register_tag()
+     * @param msg MessagePacked message
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int log(int tag, uMP &msg);
+
+    /** Keep the connection open between sends
+     *
+     * Defaults to false for TCP (connect per send) and true for TLS and custom transports.
+     *
+     * @param persistent true to keep the connection open
+     */
+    void set_persistent(bool persistent);
+
+    /** Authenticate connections with the Forward protocol shared key handshake
+     *
+     * The handshake runs once per connection, so the connection is made
+     * persistent (unless the server does not announce keepalive).
+     *
+     * @param auth shared key authentication, not owned by the logger (NULL: disable)
+     */
+    void set_auth(FluentAuth *auth);
+
+    /** Set batch threshold
+     *
+     * Messages are accumulated in the message buffer and sent together
+     * once this many bytes are pending (or the buffer is full). Messages
+     * that could not be sent stay buffered and go out with the next batch.
+     *
+     * @param bytes threshold in bytes (0: send every message immediately)
+     */
+    void set_batch(uint32_t bytes);
+
+    /** Send all buffered messages now
+     *
+     * @retval 0 Success (or nothing to send)
+     * @retval <0 Failure, messages are kept
+     */
+    int flush();
+
+    /** Send buffered messages once they have waited too long
+     *
+     * Messages are also checked on every log call, call this
+     * periodically to bound the delay when nothing else is logged.
+     *
+     * @param ms maximum delay in milliseconds (0: no time limit)
+     */
+    void set_flush_interval(uint32_t ms);
+
+    /** Tune batch size and flush interval from the measured link
+     *
+     * The batch is sized to what the link moves in half of the latency
+     * bound and the flush interval gets the rest, so a record reaches
+     * fluentd within roughly max_latency_ms. The batch is halved after
+     * a failed send. Overrides set_batch() and set_flush_interval().
+     * Not for a logger driven by FluentScheduler, which turns it off.
+     *
+     * @param min_bytes smallest batch threshold
+     * @param max_bytes largest batch threshold (not below min_bytes)
+     * @param max_latency_ms latency bound in milliseconds (0: disable)
+     * @retval 0 Success
+     * @retval -1 Failure (min_bytes above max_bytes, nothing is changed)
+     */
+    int set_adaptive(uint32_t min_bytes, uint32_t max_bytes, uint32_t max_latency_ms);
+
+    /** Flush if the oldest buffered message is due, check the connection (call periodically)
+     *
+     * @retval 0 Success (or nothing due)
+     * @retval <0 Failure, messages are kept
+     */
+    int poll();
+
+    /** Watch a persistent connection from poll()
+     *
+     * Every interval the connection is read without blocking, which
+     * notices a close or reset by the server at once. With a probe
+     * transport (e.g. FluentUDPTransport) a heartbeat is also sent to the
+     * server address, which the fluentd forward input answers; after
+     * misses unanswered heartbeats the server is considered gone. A
+     * failed connection is replaced right away by one to the next
+     * server address, before the next batch needs it.
+     *
+     * Nothing here blocks: a heartbeat is answered by the next check, so
+     * a silent server is noticed after about misses + 1 intervals. The
+     * logger requests no acks, so anything the server sends on the
+     * connection is read and dropped; do not use it on a connection
+     * whose data something else reads.
+     *
+     * @param interval_ms check interval in milliseconds (0: disable)
+     * @param probe heartbeat transport, not owned (NULL: only read the connection)
+     * @param misses unanswered heartbeats before failing over
+     */
+    void set_health_check(uint32_t interval_ms, FluentTransport *probe = NULL, int misses = FLUENT_LOGGER_PROBE_MISSES);
+
+    /** Check whether the calling thread is inside one of the logger's calls
+     *
+     * Set while a log, flush, poll, open or close call of this thread
+     * works on the buffer or the connection. Code the logger calls back
+     * into (like the mbed_trace print function for its own diagnostics)
+     * must not log through it while it is set, see FluentTraceBridge.
+     * Calls of other threads wait for the logger instead.
+     *
+     * @retval true this thread is inside a logger call
+     */
+    bool is_busy() const;
+
+    /** Hold the logger, waiting while another thread has it
+     *
+     * Every call takes it by itself; lock() only makes a sequence of
+     * calls atomic, e.g. log() followed by flush(). Nests.
+     */
+    void lock();
+
+    /** Hold the logger unless another thread has it
+     *
+     * @retval true held, call unlock()
+     * @retval false another thread is inside the logger
+     */
+    bool trylock();
+
+    /** Release the logger held by lock() or trylock()
+     */
+    void unlock();
+
+    /** Get the number of buffered messages
+     * @return messages waiting for the next flush
+     */
+    inline uint32_t get_queued_records() const
+    {
+        return _nrecords;
+    }
+
+    /** Get the time the oldest buffered message was queued
+     * @return get_time_ms() at that time, only valid while get_queued_records() > 0
+     */
+    inline uint64_t get_queued_since() const
+    {
+        return _first_at;
+    }
+
+    /** Get the number of buffered bytes
+     * @return bytes waiting for the next flush
+     */
+    inline uint32_t get_queued_bytes() const
+    {
+        return _mp->get_size();
+    }
+
+    /** Get the message buffer length
+     * @return bytes that can be buffered
+     */
+    inline uint32_t get_capacity() const
+    {
+        return _mp->get_capacity();
+    }
+
+    /** Estimate how long sending the buffered messages takes
+     *
+     * Based on the throughput measured by earlier sends.
+     *
+     * @return milliseconds (UINT32_MAX: link not measured yet)
+     */
+    uint32_t get_drain_ms() const;
+
+    /** Notify producers when the buffer fills up
+     *
+     * The callback gets true once at least high_bytes are buffered and
+     * false once the buffer drained to low_bytes or less, so producers
+     * can reduce their output before messages are dropped. It runs in
+     * the context of the log or flush call.
+     *
+     * @param high_bytes congestion threshold
+     * @param low_bytes clear threshold (below high_bytes)
+     * @param cb callback, called with the congestion state (empty: disable)
+     * @retval 0 Success
+     * @retval -1 Failure (low_bytes not below high_bytes, nothing is changed)
+     */
+    int set_watermarks(uint32_t high_bytes, uint32_t low_bytes, mbed::Callback<void(bool)> cb);
+
+    /** Keep the message buffer in memory that survives a reset
+     *
+     * Messages are encoded directly into the region, after a small
+     * header that records the length and CRC of the complete messages.
+     * Call it once at boot, before logging: messages found in a valid
+     * region are queued again and go out ahead of new ones. Place the
+     * region in a section the startup code does not clear, e.g.
+     *
+     *   MBED_SECTION(".noinit") static uint8_t retained[1024];
+     *
+     * @param region retained memory, word aligned
+     * @param size region length in bytes
+     * @retval >=0 number of messages recovered
+     * @retval -1 Failure (region too small)
+     */
+    int set_retained(void *region, uint32_t size);
+
+
+    /** Send statistics
+     */
+    struct Stats {
+        uint32_t sends;             /**< successful sends */
+        uint32_t send_errors;       /**< failed sends */
+        uint32_t records_sent;      /**< records delivered to the transport */
+        uint32_t records_dropped;   /**< records that did not fit into the buffer */
+        uint32_t bytes_sent;        /**< bytes delivered to the transport */
+        uint32_t last_send_ms;      /**< completion time of the last send (connect included) */
+        uint32_t send_ms;           /**< smoothed send completion time */
+        uint32_t throughput;        /**< smoothed bytes per second */
+        uint32_t batch_bytes;       /**< current batch threshold */
+        uint32_t flush_interval_ms; /**< current flush interval */
+        uint32_t failovers;         /**< connections replaced by the health check */
+    };
+
+    /** Get send statistics
+     *
+     * @return statistics since the logger was created
+     */
+    Stats get_stats() const;
+
+    /** Set run time level for all tags
+     *
+     * Checked by is_enabled() and so by the FLUENT_xxx macros, not by
+     * log() and logf().
+     *
+     * @param level FLUENT_LEVEL_xxx, messages below it are dropped
+     */
+    void set_level(uint8_t level);
+
+    /** Set run time level for one tag
+     *
+     * The tag string is kept by reference and must stay valid.
+     *
+     * @param tag tag
+     * @param level FLUENT_LEVEL_xxx, messages below it are dropped
+     * @retval 0 Success
+     * @retval -1 Failure (too many tags)
+     */
+    int set_level(const char *tag, uint8_t level);
+
+    /** Check whether a message would be sent
+     *
+     * Costs a single compare unless the level lies between the lowest
+     * and the highest per-tag level, only then the tag is looked up.
+     * Call it before building a uMP message to skip the encoding work.
+     *
+     * @param level FLUENT_LEVEL_xxx
+     * @param tag tag
+     * @retval true level is enabled for the tag
+     */
+    inline bool is_enabled(uint8_t level, const char *tag) const
+    {
+        if (level < _level_floor) {
+            return false;
+        }
+        if (level >= _level_ceiling) {
+            return true;
+        }
+        return level >= tag_level(tag);
+    }
+
+    /** Check whether a message with a registered tag would be sent
+     *
+     * Costs a single load, the tag level is resolved when it changes.
+     * Lets the FLUENT_xxx macros take a handle from register_tag().
+     *
+     * @param level FLUENT_LEVEL_xxx
+     * @param tag tag handle from register_tag()
+     * @retval true level is enabled for the tag
+     */
+    inline bool is_enabled(uint8_t level, int tag) const
+    {
+        return (unsigned)tag < (unsigned)_ntags && level >= _tags[tag].level;
+    }
+
+    /** Set lifetime of the cached server address
+     *
+     * The host name is resolved once and the result is reused until
+     * the TTL expires or every cached address fails to connect.
+     *
+     * @param ttl_ms cache lifetime in milliseconds (0: resolve on every send)
+     */
+    void set_dns_ttl(uint32_t ttl_ms);
+
+    /** Drop the cached server address (resolved again on next send)
+     */
+    void flush_dns();
+
+    /** Use another millisecond clock
+     *
+     * Every time the logger keeps (queue time, flush interval, DNS TTL,
+     * health checks, send duration) is read from it, so a test can
+     * drive time directly. FluentScheduler::poll() reads it as well.
+     *
+     * @param clock returns the current time in milliseconds (empty: Kernel::get_ms_count())
+     */
+    void set_clock(mbed::Callback<uint64_t()> clock);
+
+    /** Get the current time of the logger's clock
+     * @return milliseconds
+     */
+    uint64_t get_time_ms() const;
+
+protected:
+    /** Create a FluentLogger instance on caller supplied storage (no allocation)
+     *
+     * Used by StaticFluentLogger. The server address is looked up with
+     * gethostbyname() instead of getaddrinfo(), which allocates its result.
+     *
+     * @param transport transport to use, not owned by the logger
+     * @param mp message buffer, not owned by the logger
+     * @param aNetwork network interface used to resolve host
+     * @param host fluentd server hostname/ipaddress
+     * @param port fluentd server port
+     */
+    FluentLogger(FluentTransport &transport, uMP &mp, NetworkInterface* aNetwork, const char *host, const int port);
+
 private:
     /** FluentLogger
      */
     FluentLogger();
-    /** send message via TCP
+
+    /** Initialize the members, shared by the other constructors
+     *
+     * @param mp message buffer, deleted by the logger unless _no_heap is set
+     * @param transport transport to use
+     * @param own_transport delete the transport with the logger
+     * @param aNetwork network interface used to resolve host
+     * @param host fluentd server hostname/ipaddress
+     * @param port fluentd server port
+     */
+    FluentLogger(uMP *mp, FluentTransport *transport, bool own_transport, NetworkInterface* aNetwork, const char *host, const int port);
+    /** Encode message header (array, tag and timestamp)
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool start_message(const char *tag);
+
+    /** Copy the cached message header of a registered tag
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool start_message(int tag);
+
+    /** Account a completed message and send the batch if due
      * @retval 0 Success
-     * @retval -1 Failure
+     * @retval <0 Failure
+     */
+    int end_message();
+
+    /** Prepare to re-encode a message that did not fit
+     *
+     * Drops the partial message and flushes earlier ones to make room.
+     *
+     * @param mark buffer size before the message, reset to 0 on success
+     * @retval true retry encoding
+     * @retval false give up
+     */
+    bool retry_message(uint32_t &mark);
+
+    /** Account a send and retune the batch when adaptive
+     *
+     * @param bytes bytes sent (0: send failed)
+     * @param ms send completion time
+     */
+    void update_stats(uint32_t bytes, uint32_t ms);
+
+    /** Flush if the oldest buffered message is due
+     * @retval 0 Success (or nothing due)
+     * @retval <0 Failure
+     */
+    int flush_due();
+
+    /** Check the connection and fail over if it is gone
+     * @retval 0 Success (connection alive or replaced)
+     * @retval <0 nsapi error code of the reconnect
+     */
+    int check_health();
+
+    /** Collect the answer to the last heartbeat and send the next one
+     * @retval true server alive (or fewer than the allowed misses)
+     * @retval false server gone
+     */
+    bool probe();
+
+    /** Fire the watermark callback on a threshold crossing
+     */
+    void check_watermarks();
+
+    /** Record the complete messages in the retained region header
+     */
+    void commit_retained();
+
+    /** Retained region header
+     *
+     * Messages are only appended between flushes, so committing into
+     * the inactive slot and then switching slots leaves a valid state
+     * whenever a reset hits.
+     */
+    struct RetainedHeader {
+        uint32_t magic;
+        uint32_t capacity;
+        uint32_t active;
+        struct {
+            uint32_t length;
+            uint32_t records;
+            uint32_t crc;
+        } slot[2];
+    };
+
+    /** Look up the run time level of a tag
+     * @return per-tag level, or the global level
+     */
+    uint8_t tag_level(const char *tag) const;
+
+    /** Recompute _level_floor, _level_ceiling and the levels of registered tags after a level change
+     */
+    void update_levels();
+    /** Check whether a message can skip the message buffer
+     * @retval true unbatched, nothing queued and the transport gathers or takes buffers as they are
      */
-    int send();
+    bool can_send_direct() const;
+
+    /** Send the header in the message buffer and msg, gathered if the transport can
+     *
+     * The message is kept in the buffer if the send fails.
+     *
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    int send_direct(uMP &msg);
+
+    /** send buffers via the transport
+     *
+     * Uses one sendv() per attempt on a gathering transport, else
+     * send() per buffer. The buffers are advanced past sent data.
+     *
+     * @param iov buffers
+     * @param iovcnt number of buffers
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    int send(FluentIovec *iov, int iovcnt);
+
+    /** Resolve the server host name into the address cache
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    int resolve();
+
+    /** Connect socket using the address cache, failing over between addresses
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    int connect();
 
     NetworkInterface *_net;
-    Socket* _sock;
+    FluentTransport *_transport;
+    FluentAuth *_auth;
+    bool _own_transport;
+    bool _no_heap;
+    bool _persistent;
+    bool _busy;
+#if MBED_CONF_RTOS_PRESENT
+    mutable rtos::Mutex _mutex;
+#endif
     nsapi_error_t _rt;
-    bool _socket_is_tls;
     const char *_host;
     const int  _port;
     int        _timeout;
     uMP        *_mp;
+    uint32_t   _batch_bytes;
+    uint32_t   _nrecords;
+    uint32_t   _flush_interval;
+    uint64_t   _first_at;
+    uint32_t   _min_batch;
+    uint32_t   _max_batch;
+    uint32_t   _max_latency;
+    Stats      _stats;
+    uint32_t   _high_bytes;
+    uint32_t   _low_bytes;
+    bool       _congested;
+    mbed::Callback<void(bool)> _on_watermark;
+    RetainedHeader *_retained;
+    mbed::Callback<uint64_t()> _clock;
+    uint32_t   _health_interval;
+    uint64_t   _checked_at;
+    FluentTransport *_probe;
+    int        _probe_misses;
+    int        _max_misses;
+    bool       _probe_sent;
+    SocketAddress _addr[FLUENT_LOGGER_MAX_ADDRESSES];
+    int        _naddr;
+    int        _addr_idx;
+    uint64_t   _resolved_at;
+    uint32_t   _dns_ttl;
+    uint8_t    _level;
+    uint8_t    _level_floor;
+    uint8_t    _level_ceiling;
+    int        _ntag_levels;
+    struct {
+        const char *tag;
+        uint8_t    level;
+    } _tag_levels[FLUENT_LOGGER_MAX_TAG_LEVELS];
+    int        _ntags;
+    uint32_t   _tag_pool_used;
+    struct {
+        const char *tag;
+        uint16_t   offset;
+        uint16_t   size;
+        uint8_t    level;
+    } _tags[FLUENT_LOGGER_MAX_TAGS];
+    uint8_t    _tag_pool[FLUENT_LOGGER_TAG_POOL_SIZE];
+};
+
+/** FluentLogger that allocates nothing
+ *
+ * The message buffer and the transport live inside the object, so a
+ * static or stack instance needs no heap at all. Logging does not
+ * allocate either, except for a DNS query when host is a name rather
+ * than an IP address (raise the DNS TTL to keep it to boot).
+ * The connection is kept open between messages.
+ *
+ * Only the message buffer is sized per instance. The tag table, the
+ * tag pool, the per-tag levels and the address cache are members of
+ * FluentLogger sized by FLUENT_LOGGER_MAX_TAGS, FLUENT_LOGGER_TAG_POOL_SIZE,
+ * FLUENT_LOGGER_MAX_TAG_LEVELS and FLUENT_LOGGER_MAX_ADDRESSES, the same
+ * for every logger in the build; footprint() includes them.
+ *
+ *   static StaticFluentLogger<512> logger(net, "192.168.0.10");
+ *   MBED_STATIC_ASSERT(StaticFluentLogger<512>::footprint() <= 2048, "logger too large");
+ *
+ * @tparam BUFSIZE message buffer length
+ * @tparam Transport transport class constructed from a NetworkInterface
+ */
+template <uint32_t BUFSIZE, typename Transport = FluentTCPTransport>
+class StaticFluentLogger : private StaticFluentLoggerStorage<BUFSIZE, Transport>, public FluentLogger {
+public:
+    /** Create a StaticFluentLogger instance
+     *
+     * @param host fluentd server hostname/ipaddress
+     * @param port fluentd server port (default: 24224)
+     */
+    StaticFluentLogger(NetworkInterface* aNetwork, const char *host, const int port = 24224) :
+        StaticFluentLoggerStorage<BUFSIZE, Transport>(aNetwork),
+        FluentLogger(this->_transport_storage, this->_mp_storage, aNetwork, host, port)
+    {
+    }
+
+    /** RAM used by an instance
+     * @return size in bytes, usable in constant expressions
+     */
+    static constexpr size_t footprint()
+    {
+        return sizeof(StaticFluentLogger);
+    }
 };
 
 #endif // FLUENT_LOGGER_MBED_H
@@ -0,0 +1,113 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentScheduler.h"
+
+FluentScheduler::FluentScheduler(FluentLogger *logger, uint32_t max_hold_ms) :
+_logger(logger), _max_hold(max_hold_ms), _period(0), _window(0), _phase(0), _link_up(false),
+_bursts(0)
+{
+    // records only leave on a burst (or when the buffer is full); adaptive
+    // tuning would rewrite the batch threshold and interval after each send
+    _logger->set_adaptive(0, 0, 0);
+    _logger->set_batch(UINT32_MAX);
+    _logger->set_flush_interval(0);
+}
+
+void FluentScheduler::set_duty_cycle(uint32_t period_ms, uint32_t window_ms, uint32_t phase_ms)
+{
+    _period = period_ms;
+    _window = window_ms;
+    _phase = period_ms ? phase_ms % period_ms : 0;
+}
+
+void FluentScheduler::set_link_up(bool up)
+{
+    _link_up = up;
+}
+
+bool FluentScheduler::in_window(uint64_t now_ms) const
+{
+    if (_period == 0) {
+        return false;
+    }
+    return ((now_ms + _period - _phase) % _period) < _window;
+}
+
+bool FluentScheduler::is_due(uint64_t now_ms) const
+{
+    if (_logger->get_queued_records() == 0) {
+        return false;
+    }
+    if (_link_up || in_window(now_ms)) {
+        return true;
+    }
+    return _max_hold && now_ms >= _logger->get_queued_since() + _max_hold;
+}
+
+uint32_t FluentScheduler::next_wakeup(uint64_t now_ms) const
+{
+    if (is_due(now_ms)) {
+        return 0;
+    }
+    bool queued = _logger->get_queued_records() > 0;
+    uint32_t wait = UINT32_MAX;
+    if (_period) {
+        // is_due() covers being inside a window with records queued
+        uint32_t pos = (uint32_t)((now_ms + _period - _phase) % _period);
+        wait = _period - pos;
+    }
+    if (_max_hold && queued) {
+        // not due yet, so the deadline is still ahead
+        uint64_t left = _logger->get_queued_since() + _max_hold - now_ms;
+        if (left < wait) {
+            wait = (uint32_t)left;
+        }
+    }
+    return wait;
+}
+
+int FluentScheduler::poll()
+{
+    return poll(_logger->get_time_ms());
+}
+
+int FluentScheduler::poll(uint64_t now_ms)
+{
+    if (!is_due(now_ms)) {
+        return 0;
+    }
+    return urgent();
+}
+
+int FluentScheduler::urgent()
+{
+    if (_logger->get_queued_records() == 0) {
+        return 0;
+    }
+    int rt = _logger->flush();
+    if (rt < 0) {
+        return rt;
+    }
+    _bursts++;
+    return 0;
+}
+
+uint32_t FluentScheduler::get_bursts() const
+{
+    return _bursts;
+}
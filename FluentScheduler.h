@@ -0,0 +1,130 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_SCHEDULER_MBED_H
+#define FLUENT_SCHEDULER_MBED_H
+#include "mbed.h"
+#include "FluentLogger.h"
+
+/** Burst flushing aligned to radio wake windows
+ *
+ * The logger keeps records in its message buffer and only sends them
+ * when a burst is due:
+ *
+ * - inside a duty cycle window (set_duty_cycle()),
+ * - while the link is reported up (set_link_up()),
+ * - once the oldest record has been held for max_hold_ms,
+ * - immediately on urgent().
+ *
+ * A full message buffer is still flushed by the logger. All decisions
+ * take the current time as an argument, on the logger's clock: the
+ * hold time counts from when the logger queued the oldest record. To
+ * drive the schedule by a simulated clock, give it to the logger with
+ * FluentLogger::set_clock().
+ */
+class FluentScheduler {
+public:
+    /** Create a scheduler
+     *
+     * Takes over the flush policy of the logger: the batch threshold
+     * and the flush interval are disabled, and so is set_adaptive(),
+     * which must not be turned on again while the scheduler is used.
+     *
+     * @param logger logger to flush
+     * @param max_hold_ms flush records held this long regardless of the schedule (0: no limit)
+     */
+    FluentScheduler(FluentLogger *logger, uint32_t max_hold_ms = 0);
+
+    /** Set the wake windows
+     *
+     * Windows of window_ms start every period_ms, offset by phase_ms
+     * from time 0 of the millisecond clock.
+     *
+     * @param period_ms duty cycle period in milliseconds (0: disable)
+     * @param window_ms window length in milliseconds
+     * @param phase_ms window offset in milliseconds
+     */
+    void set_duty_cycle(uint32_t period_ms, uint32_t window_ms, uint32_t phase_ms = 0);
+
+    /** Report the link state
+     *
+     * Only stores a flag, so it can be called from a network status callback.
+     *
+     * @param up true while the radio is up anyway
+     */
+    void set_link_up(bool up);
+
+    /** Check whether a burst is due
+     *
+     * @param now_ms current time in milliseconds
+     * @retval true buffered records should be sent now
+     */
+    bool is_due(uint64_t now_ms) const;
+
+    /** Time until the next wake window
+     *
+     * With nothing queued this is the start of the next window, even
+     * inside one; call poll() after logging to use the rest of it.
+     *
+     * @param now_ms current time in milliseconds
+     * @return milliseconds until a burst may be due (0: due now, UINT32_MAX: never)
+     */
+    uint32_t next_wakeup(uint64_t now_ms) const;
+
+    /** Flush if a burst is due at FluentLogger::get_time_ms() (call periodically)
+     *
+     * @retval 0 Success (or nothing due)
+     * @retval <0 Failure, records are kept
+     */
+    int poll();
+
+    /** Flush if a burst is due at a given time
+     *
+     * @param now_ms current time in milliseconds
+     * @retval 0 Success (or nothing due)
+     * @retval <0 Failure, records are kept
+     */
+    int poll(uint64_t now_ms);
+
+    /** Send buffered records now, outside of the schedule
+     *
+     * Call right after logging a record that must not wait.
+     *
+     * @retval 0 Success
+     * @retval <0 Failure, records are kept
+     */
+    int urgent();
+
+    /** Get the number of bursts sent
+     * @return bursts since the scheduler was created
+     */
+    uint32_t get_bursts() const;
+
+private:
+    /** Check whether a time is inside a wake window
+     */
+    bool in_window(uint64_t now_ms) const;
+
+    FluentLogger  *_logger;
+    uint32_t      _max_hold;
+    uint32_t      _period;
+    uint32_t      _window;
+    uint32_t      _phase;
+    volatile bool _link_up;
+    uint32_t      _bursts;
+};
+
+#endif // FLUENT_SCHEDULER_MBED_H
@@ -0,0 +1,137 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentStripedLogger.h"
+
+FluentStripedLogger::FluentStripedLogger(Policy policy) :
+_policy(policy), _nlanes(0), _next_lane(0), _ntags(0)
+{
+}
+
+int FluentStripedLogger::add_lane(FluentLogger *lane)
+{
+    if (_nlanes == FLUENT_STRIPED_MAX_LANES) {
+        return -1;
+    }
+    _lanes[_nlanes] = lane;
+    return _nlanes++;
+}
+
+int FluentStripedLogger::lane_of(const char *tag)
+{
+    if (_nlanes == 0) {
+        return -1;
+    }
+    if (_policy == POLICY_ROUND_ROBIN) {
+        for (int i = 0; i < _ntags; i++) {
+            if (_tags[i].tag == tag || strcmp(_tags[i].tag, tag) == 0) {
+                return _tags[i].lane;
+            }
+        }
+        if (_ntags < FLUENT_STRIPED_MAX_TAGS) {
+            _tags[_ntags].tag = tag;
+            _tags[_ntags].lane = _next_lane;
+            _ntags++;
+            _next_lane = (_next_lane + 1) % _nlanes;
+            return _tags[_ntags - 1].lane;
+        }
+    }
+
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (const char *p = tag; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    return h % _nlanes;
+}
+
+FluentLogger *FluentStripedLogger::get_lane(int lane)
+{
+    if (lane < 0 || lane >= _nlanes) {
+        return NULL;
+    }
+    return _lanes[lane];
+}
+
+int FluentStripedLogger::get_lanes() const
+{
+    return _nlanes;
+}
+
+int FluentStripedLogger::log(const char *tag, const char *msg)
+{
+    FluentLogger *lane = get_lane(lane_of(tag));
+    if (lane == NULL) {
+        return -1;
+    }
+    return lane->log(tag, msg);
+}
+
+int FluentStripedLogger::logf(const char *tag, const char *fmt, ...)
+{
+    FluentLogger *lane = get_lane(lane_of(tag));
+    if (lane == NULL) {
+        return -1;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = lane->vlogf(tag, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int FluentStripedLogger::log(const char *tag, uMP &msg)
+{
+    FluentLogger *lane = get_lane(lane_of(tag));
+    if (lane == NULL) {
+        return -1;
+    }
+    return lane->log(tag, msg);
+}
+
+int FluentStripedLogger::flush()
+{
+    int rt = 0;
+    for (int i = 0; i < _nlanes; i++) {
+        int r = _lanes[i]->flush();
+        if (r < 0) {
+            rt = r;
+        }
+    }
+    return rt;
+}
+
+int FluentStripedLogger::poll()
+{
+    int rt = 0;
+    for (int i = 0; i < _nlanes; i++) {
+        int r = _lanes[i]->poll();
+        if (r < 0) {
+            rt = r;
+        }
+    }
+    return rt;
+}
+
+FluentLogger::Stats FluentStripedLogger::get_stats(int lane) const
+{
+    if (lane < 0 || lane >= _nlanes) {
+        FluentLogger::Stats none = FluentLogger::Stats();
+        return none;
+    }
+    return _lanes[lane]->get_stats();
+}
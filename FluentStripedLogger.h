@@ -0,0 +1,161 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_STRIPED_LOGGER_MBED_H
+#define FLUENT_STRIPED_LOGGER_MBED_H
+#include "mbed.h"
+#include "FluentLogger.h"
+#include "uMP.h"
+
+/** Maximum number of connections (lanes) */
+#ifndef FLUENT_STRIPED_MAX_LANES
+#define FLUENT_STRIPED_MAX_LANES    4
+#endif
+
+/** Maximum number of tags remembered for round robin assignment */
+#ifndef FLUENT_STRIPED_MAX_TAGS
+#define FLUENT_STRIPED_MAX_TAGS     16
+#endif
+
+/** Spread messages over several connections
+ *
+ * Each lane is a FluentLogger with its own connection (to the same or
+ * to different aggregators) and its own batch. A tag always goes to
+ * the same lane, so messages of one tag stay in order while different
+ * tags keep several connections busy: with a blocking send the data in
+ * flight is no longer limited to one socket window per round trip.
+ *
+ * All lanes are driven from the calling thread and send one after the
+ * other. Striping helps because every connection has its own socket
+ * buffer and window, not because lanes send in parallel: a lane whose
+ * send blocks (server stalled, window full) delays the other lanes too.
+ * Where that matters, log to the lanes directly from one thread each.
+ * Lanes should keep their connection open (set_persistent()), a new
+ * connection per flush leaves no window to fill.
+ *
+ * Lanes are picked by a hash of the tag, or round robin in the order
+ * tags are first seen (falling back to the hash once
+ * FLUENT_STRIPED_MAX_TAGS tags are known). Round robin keeps the tag
+ * pointers, so those tags must stay valid (e.g. string literals).
+ */
+class FluentStripedLogger {
+public:
+    enum Policy {
+        POLICY_HASH,
+        POLICY_ROUND_ROBIN
+    };
+
+    /** Create a striped logger without lanes
+     *
+     * @param policy lane assignment of new tags (default: POLICY_HASH)
+     */
+    explicit FluentStripedLogger(Policy policy = POLICY_HASH);
+
+    /** Add a lane
+     *
+     * Add all lanes before logging, tags are assigned using the
+     * number of lanes at that time.
+     *
+     * @param lane logger with its own connection, not owned
+     * @retval >=0 lane index
+     * @retval -1 Failure (too many lanes)
+     */
+    int add_lane(FluentLogger *lane);
+
+    /** Get the lane of a tag
+     *
+     * @param tag tag
+     * @return lane index, -1 without lanes
+     */
+    int lane_of(const char *tag);
+
+    /** Get a lane
+     *
+     * @param lane lane index
+     * @return logger of the lane, NULL if out of range
+     */
+    FluentLogger *get_lane(int lane);
+
+    /** Get number of lanes
+     * @return lanes added
+     */
+    int get_lanes() const;
+
+    /** Send simple string message on the lane of the tag.
+     *
+     * @param tag tag
+     * @param msg null terminated string
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int log(const char *tag, const char *msg);
+
+    /** Send printf-style formatted message on the lane of the tag.
+     *
+     * @param tag tag
+     * @param fmt printf format string
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int logf(const char *tag, const char *fmt, ...) MBED_PRINTF_METHOD(2, 3);
+
+    /** Send MassagePacked message on the lane of the tag.
+     *
+     * @param tag tag
+     * @param msg MessagePacked message
+     * @retval 0 Success
+     * @retval -1 Failure
+     */
+    int log(const char *tag, uMP &msg);
+
+    /** Send buffered messages of all lanes
+     *
+     * @retval 0 Success
+     * @retval <0 Failure of the last failing lane, its messages are kept
+     */
+    int flush();
+
+    /** Flush lanes whose oldest message is due (call periodically)
+     *
+     * @retval 0 Success
+     * @retval <0 Failure of the last failing lane, its messages are kept
+     */
+    int poll();
+
+    /** Get send statistics of a lane
+     *
+     * Counts what the lane's transport accepted. The logger requests no
+     * acks from fluentd, so records lost after that do not show here;
+     * send_errors and a throughput drop are what reveal a bad lane.
+     *
+     * @param lane lane index
+     * @return statistics of the lane (zero if out of range)
+     */
+    FluentLogger::Stats get_stats(int lane) const;
+
+private:
+    Policy       _policy;
+    FluentLogger *_lanes[FLUENT_STRIPED_MAX_LANES];
+    int          _nlanes;
+    int          _next_lane;
+    int          _ntags;
+    struct {
+        const char *tag;
+        uint8_t    lane;
+    } _tags[FLUENT_STRIPED_MAX_TAGS];
+};
+
+#endif // FLUENT_STRIPED_LOGGER_MBED_H
@@ -0,0 +1,152 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentTrace.h"
+#include "mbed_trace.h"
+
+FluentTraceBridge *FluentTraceBridge::_instance = NULL;
+
+FluentTraceBridge::FluentTraceBridge(FluentLogger *logger, const char *tag, void (*passthrough)(const char *)) :
+_logger(logger), _tag(tag), _passthrough(passthrough), _previous(NULL), _previous_config(0), _dropped(0), _mp(FLUENT_TRACE_BUFSIZE)
+{
+}
+
+FluentTraceBridge::~FluentTraceBridge()
+{
+    uninstall();
+}
+
+void FluentTraceBridge::install()
+{
+    if (_instance == this) {
+        return;
+    }
+    _previous = mbed_trace_print_function_get();
+    _previous_config = mbed_trace_config_get();
+    uint8_t config = _previous_config;
+    config &= ~(TRACE_MODE_COLOR | TRACE_MODE_PLAIN | TRACE_CARRIAGE_RETURN);
+    mbed_trace_config_set(config);
+
+    _instance = this;
+    mbed_trace_print_function_set(print);
+}
+
+void FluentTraceBridge::uninstall()
+{
+    if (_instance != this) {
+        return;
+    }
+    _instance = NULL;
+    mbed_trace_print_function_set(_previous);
+    mbed_trace_config_set(_previous_config);
+}
+
+void FluentTraceBridge::print(const char *line)
+{
+    FluentTraceBridge *self = _instance;
+    if (self == NULL) {
+        return;
+    }
+    if (self->_passthrough) {
+        self->_passthrough(line);
+    }
+    // traces from inside the logger (including the ones forward()
+    // causes) must not re-enter it while a record or send is in progress
+    if (self->_logger->is_busy()) {
+        return;
+    }
+    // another thread inside the logger may trace next and wait for the
+    // mbed_trace mutex around this call, so do not wait for it here
+    if (!self->_logger->trylock()) {
+        core_util_atomic_incr_u32(&self->_dropped, 1);
+        return;
+    }
+    self->forward(line);
+    self->_logger->unlock();
+}
+
+uint32_t FluentTraceBridge::get_dropped() const
+{
+    return _dropped;
+}
+
+/* locate the text between '[' and ']' without padding */
+static const char *parse_field(const char *p, const char **field, uint32_t *len)
+{
+    if (*p != '[') {
+        return NULL;
+    }
+    const char *end = strchr(p, ']');
+    if (end == NULL) {
+        return NULL;
+    }
+    *field = p + 1;
+    *len = end - *field;
+    while (*len > 0 && (*field)[*len - 1] == ' ') {
+        (*len)--;
+    }
+    return end + 1;
+}
+
+void FluentTraceBridge::forward(const char *line)
+{
+    const char *lvl = "";
+    const char *grp = "";
+    uint32_t nlvl = 0;
+    uint32_t ngrp = 0;
+
+    // "[LVL ][GRP ]: message"
+    const char *p = parse_field(line, &lvl, &nlvl);
+    if (p) {
+        p = parse_field(p, &grp, &ngrp);
+    }
+    if (p && p[0] == ':' && p[1] == ' ') {
+        line = p + 2;
+    } else {
+        nlvl = ngrp = 0;
+    }
+
+    uint8_t level = FLUENT_LEVEL_DEBUG;
+    if (nlvl > 0) {
+        switch (lvl[0]) {
+            case 'I': level = FLUENT_LEVEL_INFO; break;
+            case 'W': level = FLUENT_LEVEL_WARN; break;
+            case 'E': level = FLUENT_LEVEL_ERROR; break;
+            default: break;
+        }
+    }
+    if (!_logger->is_enabled(level, _tag)) {
+        return;
+    }
+
+    uint32_t nmsg = strlen(line);
+    while (nmsg > 0 && (line[nmsg - 1] == '\r' || line[nmsg - 1] == '\n')) {
+        nmsg--;
+    }
+    if (nmsg > 0xff) {
+        nmsg = 0xff;
+    }
+
+    _mp.init();
+    if (!_mp.start_map(3)
+        || !_mp.set_str("level", 5) || !_mp.set_str(lvl, nlvl)
+        || !_mp.set_str("group", 5) || !_mp.set_str(grp, ngrp)
+        || !_mp.set_str("message", 7) || !_mp.set_str(line, nmsg)) {
+        return;
+    }
+    _logger->log(_tag, _mp);
+}
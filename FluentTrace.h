@@ -0,0 +1,94 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_TRACE_MBED_H
+#define FLUENT_TRACE_MBED_H
+#include "mbed.h"
+#include "FluentLogger.h"
+#include "uMP.h"
+
+/** Record buffer size for a single trace line */
+#ifndef FLUENT_TRACE_BUFSIZE
+#define FLUENT_TRACE_BUFSIZE 300
+#endif
+
+/** Forward mbed_trace output to a FluentLogger
+ *
+ * Each trace line is sent as a {"level", "group", "message"} record
+ * through the logger, so it is batched like any other message
+ * (see FluentLogger::set_batch()).
+ *
+ * Lines traced while the logger is busy (its own diagnostics, or
+ * code it calls while sending) are not fed back into it, see
+ * FluentLogger::is_busy(); they only go to the passthrough function.
+ *
+ * Lines from any thread are forwarded while it holds the logger, which
+ * also guards the bridge's record buffer. A line traced while another
+ * thread is inside the logger is dropped and counted (get_dropped())
+ * rather than waited for: that thread may itself be waiting for the
+ * mbed_trace mutex held around this line.
+ *
+ * Only one bridge can be installed at a time.
+ */
+class FluentTraceBridge {
+public:
+    /** Create a trace bridge
+     *
+     * @param logger logger that receives the records
+     * @param tag tag of the records (default: "mbed.trace")
+     * @param passthrough function that also gets every line, e.g. to print on the console (optional)
+     */
+    FluentTraceBridge(FluentLogger *logger, const char *tag = "mbed.trace", void (*passthrough)(const char *) = NULL);
+    ~FluentTraceBridge();
+
+    /** Install as the mbed_trace print function
+     *
+     * Switches mbed_trace to uncoloured "[LVL ][GRP ]: msg" lines so they can be parsed.
+     */
+    void install();
+
+    /** Stop forwarding
+     *
+     * Restores the print function and trace configuration that were
+     * set before install().
+     */
+    void uninstall();
+
+    /** Get the number of lines dropped because another thread was inside the logger
+     * @return lines since the bridge was created
+     */
+    uint32_t get_dropped() const;
+
+private:
+    /** mbed_trace print function
+     */
+    static void print(const char *line);
+
+    /** Parse a trace line and log it
+     */
+    void forward(const char *line);
+
+    static FluentTraceBridge *_instance;
+    FluentLogger *_logger;
+    const char   *_tag;
+    void         (*_passthrough)(const char *);
+    void         (*_previous)(const char *);
+    uint8_t      _previous_config;
+    uint32_t     _dropped;
+    uMP          _mp;
+};
+
+#endif // FLUENT_TRACE_MBED_H
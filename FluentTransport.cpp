@@ -0,0 +1,300 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "FluentTransport.h"
+
+nsapi_size_or_error_t FluentTransport::sendv(const FluentIovec *iov, int iovcnt)
+{
+    nsapi_size_or_error_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        nsapi_size_or_error_t rt = send(iov[i].data, iov[i].size);
+        if (rt < 0) {
+            return rt;
+        }
+        total += rt;
+        if ((uint32_t)rt < iov[i].size) {
+            break;
+        }
+    }
+    return total;
+}
+
+/* TCP */
+FluentTCPTransport::FluentTCPTransport(NetworkInterface *net) :
+_net(net)
+{
+}
+
+nsapi_error_t FluentTCPTransport::open()
+{
+    return _sock.open(_net);
+}
+
+nsapi_error_t FluentTCPTransport::connect(const SocketAddress &addr)
+{
+    nsapi_error_t rt = _sock.connect(addr);
+    if (rt == NSAPI_ERROR_IS_CONNECTED) {
+        rt = NSAPI_ERROR_OK;
+    }
+    _connected = (rt == NSAPI_ERROR_OK);
+    return rt;
+}
+
+nsapi_size_or_error_t FluentTCPTransport::send(const void *data, uint32_t size)
+{
+    return _sock.send(data, size);
+}
+
+nsapi_size_or_error_t FluentTCPTransport::recv(void *data, uint32_t size)
+{
+    return _sock.recv(data, size);
+}
+
+nsapi_error_t FluentTCPTransport::close()
+{
+    _connected = false;
+    return _sock.close();
+}
+
+/* TLS */
+FluentTLSTransport::FluentTLSTransport(NetworkInterface *net, const char *ssl_ca_pem, const char *hostname) :
+_net(net)
+{
+    _sock.set_root_ca_cert(ssl_ca_pem);
+    // connect() goes by address, certificate is still checked against the name
+    _sock.set_hostname(hostname);
+}
+
+nsapi_error_t FluentTLSTransport::open()
+{
+    return _sock.open(_net);
+}
+
+nsapi_error_t FluentTLSTransport::connect(const SocketAddress &addr)
+{
+    nsapi_error_t rt = _sock.connect(addr);
+    if (rt == NSAPI_ERROR_IS_CONNECTED) {
+        rt = NSAPI_ERROR_OK;
+    }
+    _connected = (rt == NSAPI_ERROR_OK);
+    return rt;
+}
+
+nsapi_size_or_error_t FluentTLSTransport::send(const void *data, uint32_t size)
+{
+    return _sock.send(data, size);
+}
+
+nsapi_size_or_error_t FluentTLSTransport::recv(void *data, uint32_t size)
+{
+    return _sock.recv(data, size);
+}
+
+nsapi_error_t FluentTLSTransport::close()
+{
+    _connected = false;
+    return _sock.close();
+}
+
+/* UDP */
+FluentUDPTransport::FluentUDPTransport(NetworkInterface *net) :
+_net(net)
+{
+}
+
+nsapi_error_t FluentUDPTransport::open()
+{
+    return _sock.open(_net);
+}
+
+nsapi_error_t FluentUDPTransport::connect(const SocketAddress &addr)
+{
+    _peer = addr;
+    _connected = true;
+    return NSAPI_ERROR_OK;
+}
+
+nsapi_size_or_error_t FluentUDPTransport::send(const void *data, uint32_t size)
+{
+    return _sock.sendto(_peer, data, size);
+}
+
+nsapi_size_or_error_t FluentUDPTransport::recv(void *data, uint32_t size)
+{
+    return _sock.recvfrom(NULL, data, size);
+}
+
+nsapi_error_t FluentUDPTransport::close()
+{
+    _connected = false;
+    return _sock.close();
+}
+
+/* Serial */
+FluentSerialTransport::FluentSerialTransport(mbed::FileHandle *fh) :
+_fh(fh), _seq(0), _enc(output, fh)
+{
+}
+
+int FluentSerialTransport::output(void *ctx, const uint8_t *data, uint32_t size)
+{
+    mbed::FileHandle *fh = (mbed::FileHandle *)ctx;
+    while (size > 0) {
+        ssize_t n = fh->write(data, size);
+        if (n < 0) {
+            return NSAPI_ERROR_DEVICE_ERROR;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+nsapi_error_t FluentSerialTransport::open()
+{
+    return NSAPI_ERROR_OK;
+}
+
+nsapi_error_t FluentSerialTransport::connect(const SocketAddress &addr)
+{
+    _connected = true;
+    return NSAPI_ERROR_OK;
+}
+
+nsapi_size_or_error_t FluentSerialTransport::send(const void *data, uint32_t size)
+{
+    FluentIovec iov = { data, size };
+    return sendv(&iov, 1);
+}
+
+nsapi_size_or_error_t FluentSerialTransport::sendv(const FluentIovec *iov, int iovcnt)
+{
+    uint32_t total = 0;
+    int rt = _enc.begin(_seq++);
+    for (int i = 0; i < iovcnt && rt == 0; i++) {
+        rt = _enc.write(iov[i].data, iov[i].size);
+        total += iov[i].size;
+    }
+    if (rt == 0) {
+        rt = _enc.end();
+    }
+    if (rt < 0) {
+        return rt;
+    }
+    return total;
+}
+
+nsapi_size_or_error_t FluentSerialTransport::recv(void *data, uint32_t size)
+{
+    ssize_t n = _fh->read(data, size);
+    if (n == -EAGAIN) {
+        return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    if (n < 0) {
+        return NSAPI_ERROR_DEVICE_ERROR;
+    }
+    return n;
+}
+
+nsapi_error_t FluentSerialTransport::close()
+{
+    _connected = false;
+    return NSAPI_ERROR_OK;
+}
+
+/* Loopback */
+FluentLoopbackTransport::FluentLoopbackTransport(uint8_t *buf, uint32_t size) :
+_buf(buf), _nbuf(size), _ptr(0), _rx(NULL), _nrx(0), _error(NSAPI_ERROR_OK),
+_caps(CAP_STREAM | CAP_GATHER | CAP_ZERO_COPY), _writes(0)
+{
+}
+
+nsapi_error_t FluentLoopbackTransport::open()
+{
+    return _error;
+}
+
+nsapi_error_t FluentLoopbackTransport::connect(const SocketAddress &addr)
+{
+    _connected = (_error == NSAPI_ERROR_OK);
+    return _error;
+}
+
+nsapi_size_or_error_t FluentLoopbackTransport::send(const void *data, uint32_t size)
+{
+    if (_error != NSAPI_ERROR_OK) {
+        return _error;
+    }
+    //buffer overflow?
+    if ( (_ptr+size) > _nbuf) {
+        return NSAPI_ERROR_NO_MEMORY;
+    }
+    memcpy(_buf + _ptr, data, size);
+    _ptr += size;
+    _writes++;
+    return size;
+}
+
+nsapi_size_or_error_t FluentLoopbackTransport::sendv(const FluentIovec *iov, int iovcnt)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].size;
+    }
+    if (_error != NSAPI_ERROR_OK) {
+        return _error;
+    }
+    // all or nothing, like a single write
+    if ( (_ptr+total) > _nbuf) {
+        return NSAPI_ERROR_NO_MEMORY;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(_buf + _ptr, iov[i].data, iov[i].size);
+        _ptr += iov[i].size;
+    }
+    _writes++;
+    return total;
+}
+
+nsapi_size_or_error_t FluentLoopbackTransport::recv(void *data, uint32_t size)
+{
+    if (_error != NSAPI_ERROR_OK) {
+        return _error;
+    }
+    if (_nrx == 0) {
+        return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    if (size > _nrx) {
+        size = _nrx;
+    }
+    memcpy(data, _rx, size);
+    _rx += size;
+    _nrx -= size;
+    return size;
+}
+
+nsapi_error_t FluentLoopbackTransport::close()
+{
+    _connected = false;
+    return NSAPI_ERROR_OK;
+}
+
+void FluentLoopbackTransport::inject(const void *data, uint32_t size)
+{
+    _rx = (const uint8_t *)data;
+    _nrx = size;
+}
@@ -0,0 +1,305 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLUENT_TRANSPORT_MBED_H
+#define FLUENT_TRANSPORT_MBED_H
+#include "mbed.h"
+#include "TCPSocket.h"
+#include "TLSSocket.h"
+#include "UDPSocket.h"
+#include "FluentFrame.h"
+
+/** One buffer of a gathered write
+ */
+struct FluentIovec {
+    const void *data;
+    uint32_t   size;
+};
+
+/** Link between FluentLogger and the fluentd server
+ *
+ */
+class FluentTransport {
+public:
+    /** Transport capabilities
+     */
+    enum Capability {
+        CAP_STREAM    = 0x01, ///< reliable, ordered byte stream
+        CAP_ADDRESS   = 0x02, ///< connect() needs a resolved server address
+        CAP_GATHER    = 0x04, ///< sendv() writes all buffers in one operation (the logger then sends messages without copying them)
+        CAP_ZERO_COPY = 0x08, ///< send() takes the caller's buffer as is, with no framing of its own (with CAP_STREAM the logger then sends messages without copying them, in one send() per buffer)
+    };
+
+    FluentTransport() : _connected(false) {}
+    virtual ~FluentTransport() {}
+
+    /** Get transport capabilities
+     *
+     * @return CAP_xxx flags
+     */
+    virtual uint32_t capabilities() const = 0;
+
+    /** Prepare the link (open socket)
+     *
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_error_t open() = 0;
+
+    /** Connect to the server
+     *
+     * @param addr server address (ignored without CAP_ADDRESS)
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_error_t connect(const SocketAddress &addr) = 0;
+
+    /** Send data
+     *
+     * @param data Pointer of data
+     * @param size Size of data
+     * @retval >=0 Number of bytes sent
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size) = 0;
+
+    /** Send several buffers
+     *
+     * The default implementation calls send() for each buffer.
+     *
+     * @param iov buffers
+     * @param iovcnt number of buffers
+     * @retval >=0 Number of bytes sent
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_size_or_error_t sendv(const FluentIovec *iov, int iovcnt);
+
+    /** Receive data
+     *
+     * @param data Pointer of receive buffer
+     * @param size Size of receive buffer
+     * @retval >0 Number of bytes received
+     * @retval 0 Connection closed by peer
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size) = 0;
+
+    /** Close the link
+     *
+     * @retval 0 Success
+     * @retval <0 nsapi error code
+     */
+    virtual nsapi_error_t close() = 0;
+
+    /** Set blocking timeout of send/recv
+     *
+     * @param timeout_ms timeout in milliseconds (-1: block forever, 0: non-blocking)
+     */
+    virtual void set_timeout(int timeout_ms) {}
+
+    /** Check connection state
+     *
+     * @retval true connected
+     */
+    inline bool is_connected() const { return _connected; }
+
+protected:
+    bool _connected;
+};
+
+/** TCP transport
+ *
+ */
+class FluentTCPTransport : public FluentTransport {
+public:
+    /** Create TCP transport
+     *
+     * @param net network interface
+     */
+    explicit FluentTCPTransport(NetworkInterface *net);
+
+    virtual uint32_t capabilities() const { return CAP_STREAM | CAP_ADDRESS | CAP_ZERO_COPY; }
+    virtual nsapi_error_t open();
+    virtual nsapi_error_t connect(const SocketAddress &addr);
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size);
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size);
+    virtual nsapi_error_t close();
+    virtual void set_timeout(int timeout_ms) { _sock.set_timeout(timeout_ms); }
+
+protected:
+    NetworkInterface *_net;
+    TCPSocket        _sock;
+};
+
+/** TLS transport
+ *
+ */
+class FluentTLSTransport : public FluentTransport {
+public:
+    /** Create TLS transport
+     *
+     * @param net network interface
+     * @param ssl_ca_pem root CA certificate (PEM)
+     * @param hostname server name the certificate is checked against
+     */
+    FluentTLSTransport(NetworkInterface *net, const char *ssl_ca_pem, const char *hostname);
+
+    virtual uint32_t capabilities() const { return CAP_STREAM | CAP_ADDRESS | CAP_ZERO_COPY; }
+    virtual nsapi_error_t open();
+    virtual nsapi_error_t connect(const SocketAddress &addr);
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size);
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size);
+    virtual nsapi_error_t close();
+    virtual void set_timeout(int timeout_ms) { _sock.set_timeout(timeout_ms); }
+
+protected:
+    NetworkInterface *_net;
+    TLSSocket        _sock;
+};
+
+/** UDP transport
+ *
+ * fluentd only accepts heartbeats over UDP, use it for probes
+ * rather than for messages.
+ */
+class FluentUDPTransport : public FluentTransport {
+public:
+    /** Create UDP transport
+     *
+     * @param net network interface
+     */
+    explicit FluentUDPTransport(NetworkInterface *net);
+
+    virtual uint32_t capabilities() const { return CAP_ADDRESS | CAP_ZERO_COPY; }
+    virtual nsapi_error_t open();
+    virtual nsapi_error_t connect(const SocketAddress &addr);
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size);
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size);
+    virtual nsapi_error_t close();
+    virtual void set_timeout(int timeout_ms) { _sock.set_timeout(timeout_ms); }
+
+protected:
+    NetworkInterface *_net;
+    UDPSocket        _sock;
+    SocketAddress    _peer;
+};
+
+/** Framed serial transport
+ *
+ * Sends every batch as one CRC protected SLIP frame (see FluentFrame.h)
+ * over a serial port, e.g. BufferedSerial, to a gateway running
+ * tools/fluent-serial-relay which forwards it to fluentd.
+ */
+class FluentSerialTransport : public FluentTransport {
+public:
+    /** Create serial transport
+     *
+     * @param fh serial port
+     */
+    explicit FluentSerialTransport(mbed::FileHandle *fh);
+
+    virtual uint32_t capabilities() const { return CAP_GATHER; }
+    virtual nsapi_error_t open();
+    virtual nsapi_error_t connect(const SocketAddress &addr);
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size);
+    virtual nsapi_size_or_error_t sendv(const FluentIovec *iov, int iovcnt);
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size);
+    virtual nsapi_error_t close();
+
+protected:
+    /** FluentFrameEncoder output, writes to the serial port
+     */
+    static int output(void *ctx, const uint8_t *data, uint32_t size);
+
+    mbed::FileHandle   *_fh;
+    uint16_t           _seq;
+    FluentFrameEncoder _enc;
+};
+
+/** In-memory transport
+ *
+ * Everything sent is appended to a caller supplied buffer, received
+ * data comes from inject(). Lets the logger run without a network,
+ * e.g. to test it or to measure the cost of each send path (see
+ * set_capabilities()).
+ */
+class FluentLoopbackTransport : public FluentTransport {
+public:
+    /** Create loopback transport
+     *
+     * @param buf buffer that collects sent data
+     * @param size buffer length
+     */
+    FluentLoopbackTransport(uint8_t *buf, uint32_t size);
+
+    virtual uint32_t capabilities() const { return _caps; }
+    virtual nsapi_error_t open();
+    virtual nsapi_error_t connect(const SocketAddress &addr);
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size);
+    virtual nsapi_size_or_error_t sendv(const FluentIovec *iov, int iovcnt);
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size);
+    virtual nsapi_error_t close();
+
+    /** Make following operations fail
+     *
+     * @param error nsapi error code to return (0: work normally)
+     */
+    void set_error(nsapi_error_t error) { _error = error; }
+
+    /** Report other capabilities
+     *
+     * Makes the logger take the send path it would take for another
+     * transport, e.g. CAP_STREAM alone for one that copies every message.
+     *
+     * @param caps CAP_xxx flags (default: CAP_STREAM | CAP_GATHER | CAP_ZERO_COPY)
+     */
+    void set_capabilities(uint32_t caps) { _caps = caps; }
+
+    /** Get number of successful send() and sendv() calls
+     */
+    inline uint32_t get_writes() const { return _writes; }
+
+    /** Queue data for recv()
+     *
+     * @param data Pointer of data, must stay valid until received
+     * @param size Size of data
+     */
+    void inject(const void *data, uint32_t size);
+
+    /** Get number of bytes sent so far
+     */
+    inline uint32_t get_size() const { return _ptr; }
+
+    /** Get sent data
+     */
+    inline const uint8_t *get_buffer() const { return _buf; }
+
+    /** Discard sent data and reset the write count
+     */
+    void clear() { _ptr = 0; _writes = 0; }
+
+protected:
+    uint8_t       *_buf;
+    uint32_t      _nbuf;
+    uint32_t      _ptr;
+    const uint8_t *_rx;
+    uint32_t      _nrx;
+    nsapi_error_t _error;
+    uint32_t      _caps;
+    uint32_t      _writes;
+};
+
+#endif // FLUENT_TRANSPORT_MBED_H
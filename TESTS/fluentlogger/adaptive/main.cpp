@@ -0,0 +1,191 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define MIN_BYTES 64
+#define MAX_BYTES 1024
+#define LATENCY   1000
+
+static uint64_t now_ms;
+
+static uint64_t sim_clock()
+{
+    return now_ms;
+}
+
+/* A link where every send takes a known time on the simulated clock */
+class SlowTransport : public FluentLoopbackTransport {
+public:
+    SlowTransport(uint8_t *buf, uint32_t size) : FluentLoopbackTransport(buf, size), delay_ms(0) {}
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size)
+    {
+        now_ms += delay_ms;
+        return FluentLoopbackTransport::send(data, size);
+    }
+    virtual nsapi_size_or_error_t sendv(const FluentIovec *iov, int iovcnt)
+    {
+        now_ms += delay_ms;
+        return FluentLoopbackTransport::sendv(iov, iovcnt);
+    }
+    uint32_t delay_ms;
+};
+
+static uint8_t sent[4096];
+
+/* Queue a record below the smallest batch and send it taking delay_ms */
+static uint32_t send_batch(FluentLogger &logger, SlowTransport &lo, uint32_t delay_ms)
+{
+    lo.clear();
+    lo.delay_ms = delay_ms;
+    TEST_ASSERT_EQUAL(0, logger.log("test.adaptive", "record"));
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    TEST_ASSERT_EQUAL(1, lo.get_writes());
+    return lo.get_size();
+}
+
+static void test_initial()
+{
+    now_ms = 0;
+    SlowTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_clock(sim_clock);
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MIN_BYTES, MAX_BYTES, LATENCY));
+
+    // small batches until the link is measured
+    FluentLogger::Stats stats = logger.get_stats();
+    TEST_ASSERT_EQUAL(MIN_BYTES, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(LATENCY / 2, stats.flush_interval_ms);
+}
+
+static void test_fast_link()
+{
+    now_ms = 0;
+    SlowTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_clock(sim_clock);
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MIN_BYTES, MAX_BYTES, LATENCY));
+
+    uint32_t bytes = send_batch(logger, lo, 1);
+    FluentLogger::Stats stats = logger.get_stats();
+    TEST_ASSERT_EQUAL(1, stats.send_ms);
+    TEST_ASSERT_EQUAL(bytes * 1000, stats.throughput);
+    // what the link moves in half the bound is far above the limit
+    TEST_ASSERT_EQUAL(MAX_BYTES, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(LATENCY - 1, stats.flush_interval_ms);
+}
+
+static void test_slow_link()
+{
+    now_ms = 0;
+    SlowTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_clock(sim_clock);
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MIN_BYTES, MAX_BYTES, LATENCY));
+
+    // 100 ms per batch: half the bound moves five batches
+    uint32_t bytes = send_batch(logger, lo, 100);
+    FluentLogger::Stats stats = logger.get_stats();
+    TEST_ASSERT_EQUAL(100, stats.send_ms);
+    TEST_ASSERT_EQUAL(bytes * 10, stats.throughput);
+    TEST_ASSERT_EQUAL(bytes * 5, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(LATENCY - 100, stats.flush_interval_ms);
+
+    // 900 ms per batch: the smallest batch, the interval at its floor
+    now_ms = 0;
+    SlowTransport lo2(sent, sizeof(sent));
+    FluentLogger logger2(&lo2);
+    logger2.set_clock(sim_clock);
+    TEST_ASSERT_EQUAL(0, logger2.set_adaptive(MIN_BYTES, MAX_BYTES, LATENCY));
+    send_batch(logger2, lo2, 900);
+    stats = logger2.get_stats();
+    TEST_ASSERT_EQUAL(MIN_BYTES, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(LATENCY / 4, stats.flush_interval_ms);
+}
+
+static void test_failing_link()
+{
+    now_ms = 0;
+    SlowTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_clock(sim_clock);
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MIN_BYTES, MAX_BYTES, LATENCY));
+    send_batch(logger, lo, 1);
+    TEST_ASSERT_EQUAL(MAX_BYTES, logger.get_stats().batch_bytes);
+
+    // every failed send halves the batch, down to the minimum
+    lo.set_error(NSAPI_ERROR_CONNECTION_LOST);
+    TEST_ASSERT_EQUAL(0, logger.log("test.adaptive", "kept"));
+    uint32_t expected = MAX_BYTES;
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_TRUE(logger.flush() < 0);
+        expected = expected / 2 < MIN_BYTES ? MIN_BYTES : expected / 2;
+        TEST_ASSERT_EQUAL(expected, logger.get_stats().batch_bytes);
+    }
+    TEST_ASSERT_EQUAL(6, logger.get_stats().send_errors);
+}
+
+static void test_bad_arguments()
+{
+    now_ms = 0;
+    SlowTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_clock(sim_clock);
+    logger.set_batch(100);
+    logger.set_flush_interval(300);
+
+    TEST_ASSERT_EQUAL(-1, logger.set_adaptive(MAX_BYTES, MIN_BYTES, LATENCY));
+    FluentLogger::Stats stats = logger.get_stats();
+    TEST_ASSERT_EQUAL(100, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(300, stats.flush_interval_ms);
+
+    // a bound below 4 ms still keeps a time limit on the batch
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MIN_BYTES, MAX_BYTES, 1));
+    TEST_ASSERT_EQUAL(1, logger.get_stats().flush_interval_ms);
+    send_batch(logger, lo, 3);
+    TEST_ASSERT_EQUAL(1, logger.get_stats().flush_interval_ms);
+
+    // disabling takes any sizes
+    TEST_ASSERT_EQUAL(0, logger.set_adaptive(MAX_BYTES, MIN_BYTES, 0));
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("starts with the smallest batch", test_initial),
+    Case("fast link gets the largest batch", test_fast_link),
+    Case("slow link gets smaller batches and less waiting", test_slow_link),
+    Case("failed sends halve the batch", test_failing_link),
+    Case("bad bounds are rejected", test_bad_arguments),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
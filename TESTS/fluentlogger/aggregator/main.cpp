@@ -0,0 +1,194 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+#include "FluentAggregator.h"
+
+using namespace utest::v1;
+
+#define WINDOW_MS 1000
+
+static uint8_t sent[1024];
+
+/* Expected summary of one metric */
+struct Summary {
+    const char *key;
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    const uint32_t *hist;
+};
+
+static void expect_key(uMPReader &rd, const char *key)
+{
+    const char *s;
+    uint32_t n;
+    TEST_ASSERT_TRUE(rd.get_str(&s, &n));
+    TEST_ASSERT_EQUAL(strlen(key), n);
+    TEST_ASSERT_EQUAL_MEMORY(key, s, n);
+}
+
+static float get_float(uMPReader &rd)
+{
+    const uint8_t *p;
+    uint32_t size;
+    TEST_ASSERT_TRUE(rd.skip(&p, &size));
+    TEST_ASSERT_EQUAL(5, size);
+    TEST_ASSERT_EQUAL_HEX8(0xca, p[0]);
+    uint32_t u = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4];
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+/* Decode one [tag, time, {"window", metrics...}] record */
+static void check_record(uMPReader &rd, const Summary *metrics, int n)
+{
+    uint32_t size;
+    uint64_t u;
+    TEST_ASSERT_TRUE(rd.get_array(&size));
+    TEST_ASSERT_EQUAL(3, size);
+    expect_key(rd, "sensor.summary");
+    TEST_ASSERT_TRUE(rd.skip());
+
+    TEST_ASSERT_TRUE(rd.get_map(&size));
+    TEST_ASSERT_EQUAL(n + 1, size);
+    expect_key(rd, "window");
+    TEST_ASSERT_TRUE(rd.get_uint(&u));
+    TEST_ASSERT_EQUAL(WINDOW_MS, u);
+
+    for (int i = 0; i < n; i++) {
+        const Summary &m = metrics[i];
+        expect_key(rd, m.key);
+        TEST_ASSERT_TRUE(rd.get_map(&size));
+        TEST_ASSERT_EQUAL(m.hist ? 5 : 4, size);
+        expect_key(rd, "count");
+        TEST_ASSERT_TRUE(rd.get_uint(&u));
+        TEST_ASSERT_EQUAL(m.count, u);
+        expect_key(rd, "min");
+        TEST_ASSERT_EQUAL_FLOAT(m.min, get_float(rd));
+        expect_key(rd, "max");
+        TEST_ASSERT_EQUAL_FLOAT(m.max, get_float(rd));
+        expect_key(rd, "mean");
+        TEST_ASSERT_EQUAL_FLOAT(m.mean, get_float(rd));
+        if (m.hist) {
+            expect_key(rd, "hist");
+            TEST_ASSERT_TRUE(rd.get_array(&size));
+            TEST_ASSERT_EQUAL(FLUENT_AGGREGATOR_BINS, size);
+            for (int b = 0; b < FLUENT_AGGREGATOR_BINS; b++) {
+                TEST_ASSERT_TRUE(rd.get_uint(&u));
+                TEST_ASSERT_EQUAL(m.hist[b], u);
+            }
+        }
+    }
+}
+
+static void test_summary()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    FluentAggregator agg(&logger, "sensor.summary", WINDOW_MS);
+    int temp = agg.add_metric("temp", 0.0f, 40.0f);
+    int hum = agg.add_metric("hum");
+    int idle = agg.add_metric("idle");
+    TEST_ASSERT_EQUAL(0, temp);
+    TEST_ASSERT_EQUAL(1, hum);
+    TEST_ASSERT_EQUAL(2, idle);
+
+    // below and above the histogram land in the outer bins
+    const float temps[5] = { 10.0f, 20.0f, 30.0f, 50.0f, -5.0f };
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(0, agg.add(temp, temps[i], i * 100));
+    }
+    TEST_ASSERT_EQUAL(0, agg.add(hum, 40.0f, 500));
+    TEST_ASSERT_EQUAL(0, agg.add(hum, 60.0f, WINDOW_MS - 1));
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+
+    // the sample that closes the window goes into the next one
+    TEST_ASSERT_EQUAL(0, agg.add(temp, 1.0f, WINDOW_MS));
+    const uint32_t bins[FLUENT_AGGREGATOR_BINS] = { 1, 0, 1, 0, 1, 0, 1, 1 };
+    const Summary first[2] = {
+        { "temp", 5, -5.0f, 50.0f, 21.0f, bins },
+        { "hum", 2, 40.0f, 60.0f, 50.0f, NULL },
+    };
+    uMPReader rd(lo.get_buffer(), lo.get_size());
+    check_record(rd, first, 2);
+    TEST_ASSERT_EQUAL(0, rd.get_remaining());
+
+    lo.clear();
+    TEST_ASSERT_EQUAL(0, agg.poll(2 * WINDOW_MS));
+    const uint32_t bins2[FLUENT_AGGREGATOR_BINS] = { 1, 0, 0, 0, 0, 0, 0, 0 };
+    const Summary second[1] = {
+        { "temp", 1, 1.0f, 1.0f, 1.0f, bins2 },
+    };
+    uMPReader rd2(lo.get_buffer(), lo.get_size());
+    check_record(rd2, second, 1);
+    TEST_ASSERT_EQUAL(0, rd2.get_remaining());
+}
+
+static void test_window_grid()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    FluentAggregator agg(&logger, "sensor.summary", WINDOW_MS);
+    int temp = agg.add_metric("temp");
+
+    TEST_ASSERT_EQUAL(0, agg.poll(0));
+    TEST_ASSERT_EQUAL(0, agg.add(temp, 1.0f, 10));
+    // polled late: one record, the windows stay on the 1000 ms grid
+    TEST_ASSERT_EQUAL(0, agg.poll(3 * WINDOW_MS + 500));
+    TEST_ASSERT_TRUE(lo.get_size() > 0);
+    lo.clear();
+
+    // empty windows log nothing
+    TEST_ASSERT_EQUAL(0, agg.add(temp, 2.0f, 3 * WINDOW_MS + 900));
+    TEST_ASSERT_EQUAL(0, agg.poll(4 * WINDOW_MS - 1));
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+    TEST_ASSERT_EQUAL(0, agg.poll(4 * WINDOW_MS));
+    TEST_ASSERT_TRUE(lo.get_size() > 0);
+    lo.clear();
+    TEST_ASSERT_EQUAL(0, agg.poll(6 * WINDOW_MS));
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+
+    // emit() closes the window right away
+    TEST_ASSERT_EQUAL(0, agg.add(temp, 3.0f, 6 * WINDOW_MS + 1));
+    TEST_ASSERT_EQUAL(0, agg.emit());
+    TEST_ASSERT_TRUE(lo.get_size() > 0);
+    TEST_ASSERT_EQUAL(-1, agg.add(5, 1.0f, 6 * WINDOW_MS + 2));
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("summary record of a window", test_summary),
+    Case("windows stay on their grid", test_window_grid),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
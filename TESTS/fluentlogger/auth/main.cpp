@@ -0,0 +1,261 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "mbedtls/sha512.h"
+#include "FluentAuth.h"
+#include "uMP.h"
+
+using namespace utest::v1;
+
+#define KEY "secret"
+#define NONCE "0123456789abcdef"
+#define AUTH_SALT "fedcba9876543210"
+
+static void sha512_hex(char hex[129], const char *a, const char *b, const char *c, const char *d)
+{
+    static const char digits[] = "0123456789abcdef";
+    mbedtls_sha512_context ctx;
+    uint8_t md[64];
+
+    mbedtls_sha512_init(&ctx);
+    mbedtls_sha512_starts_ret(&ctx, 0);
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)a, strlen(a));
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)b, strlen(b));
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)c, strlen(c));
+    mbedtls_sha512_update_ret(&ctx, (const unsigned char *)d, strlen(d));
+    mbedtls_sha512_finish_ret(&ctx, md);
+    mbedtls_sha512_free(&ctx);
+    for (int i = 0; i < 64; i++) {
+        hex[i * 2]     = digits[md[i] >> 4];
+        hex[i * 2 + 1] = digits[md[i] & 0x0f];
+    }
+    hex[128] = '\0';
+}
+
+/* fluentd <security> side of the handshake, checks the PING and answers it */
+class FakeFluentd : public FluentTransport {
+public:
+    FakeFluentd(const char *password = NULL, const uint8_t *replay = NULL, uint32_t nreplay = 0) :
+        _password(password), _replay(replay), _nreplay(nreplay), _state(0), _nping(0), _npong(0),
+        _sends(0), _ping_ok(false) {}
+
+    virtual uint32_t capabilities() const { return CAP_STREAM; }
+    virtual nsapi_error_t open() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t connect(const SocketAddress &addr) { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t close() { return NSAPI_ERROR_OK; }
+
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size)
+    {
+        if (_nping + size > sizeof(_ping)) {
+            return NSAPI_ERROR_NO_MEMORY;
+        }
+        memcpy(_ping + _nping, data, size);
+        _nping += size;
+        _sends++;
+        return size;
+    }
+
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size)
+    {
+        uMP mp((uint8_t *)data, size);
+        if (_state == 0) {
+            // ["HELO", {"nonce": nonce, "auth": salt, "keepalive": true}]
+            _state = 1;
+            mp.start_array(2);
+            mp.set_str("HELO");
+            mp.start_map(3);
+            mp.set_str("nonce");
+            mp.set_str(NONCE);
+            mp.set_str("auth");
+            mp.set_str(_password ? AUTH_SALT : "");
+            mp.set_str("keepalive");
+            mp.set_true();
+            return mp.get_size();
+        }
+        if (_state == 1) {
+            _state = 2;
+            if (_replay) {
+                memcpy(data, _replay, _nreplay);
+                return _nreplay;
+            }
+            pong(mp);
+            memcpy(_pong, data, mp.get_size());
+            _npong = mp.get_size();
+            return mp.get_size();
+        }
+        return 0;
+    }
+
+    const uint8_t *get_pong() const { return _pong; }
+    uint32_t get_pong_size() const { return _npong; }
+    int get_sends() const { return _sends; }
+    bool ping_ok() const { return _ping_ok; }
+
+private:
+    void pong(uMP &mp)
+    {
+        char host[256], salt[256], user[256], hex[129];
+        const char *s;
+        uint32_t n, ns;
+        uMPReader rd(_ping, _nping);
+
+        _ping_ok = rd.get_array(&n) && n == 6 && rd.get_str(&s, &ns) && ns == 4 && memcmp(s, "PING", 4) == 0
+                   && get_cstr(rd, host) && get_cstr(rd, salt) && rd.get_str(&s, &ns) && ns == 128;
+        if (_ping_ok) {
+            sha512_hex(hex, salt, host, NONCE, KEY);
+            _ping_ok = memcmp(hex, s, 128) == 0 && get_cstr(rd, user) && rd.get_str(&s, &ns);
+        }
+        if (_ping_ok && _password) {
+            sha512_hex(hex, AUTH_SALT, user, _password, "");
+            _ping_ok = ns == 128 && memcmp(hex, s, 128) == 0;
+        }
+        _ping_ok = _ping_ok && rd.get_pos() == _nping;
+
+        // ["PONG", auth_result, reason, server_hostname, sha512_hex(salt + server_hostname + nonce + shared_key)]
+        mp.start_array(5);
+        mp.set_str("PONG");
+        _ping_ok ? mp.set_true() : mp.set_false();
+        mp.set_str(_ping_ok ? "" : "invalid PING");
+        mp.set_str("fluentd");
+        if (_ping_ok) {
+            sha512_hex(hex, salt, "fluentd", NONCE, KEY);
+            mp.set_str(hex, 128);
+        } else {
+            mp.set_str("");
+        }
+    }
+
+    static bool get_cstr(uMPReader &rd, char out[256])
+    {
+        const char *s;
+        uint32_t ns;
+        if (!rd.get_str(&s, &ns) || ns > 255) {
+            return false;
+        }
+        memcpy(out, s, ns);
+        out[ns] = '\0';
+        return true;
+    }
+
+    const char *_password;
+    const uint8_t *_replay;
+    uint32_t _nreplay;
+    int _state;
+    uint8_t _ping[1024];
+    uint32_t _nping;
+    uint8_t _pong[256];
+    uint32_t _npong;
+    int _sends;
+    bool _ping_ok;
+};
+
+#if DEVICE_TRNG
+static void test_shared_key()
+{
+    FakeFluentd server;
+    FluentAuth auth("device1", KEY);
+
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, auth.handshake(&server));
+    TEST_ASSERT_TRUE(server.ping_ok());
+    TEST_ASSERT_TRUE(auth.keepalive());
+}
+
+static void test_user_auth_long_names()
+{
+    // PING is about 300 bytes plus both names, more than FLUENT_AUTH_BUFSIZE
+    char host[201], user[201];
+    memset(host, 'h', 200);
+    host[200] = '\0';
+    memset(user, 'u', 200);
+    user[200] = '\0';
+    FakeFluentd server("password");
+    FluentAuth auth(host, KEY, user, "password");
+
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, auth.handshake(&server));
+    TEST_ASSERT_TRUE(server.ping_ok());
+    TEST_ASSERT_GREATER_THAN(1, server.get_sends());
+}
+
+static void test_wrong_password()
+{
+    FakeFluentd server("password");
+    FluentAuth auth("device1", KEY, "user", "wrong");
+
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_AUTH_FAILURE, auth.handshake(&server));
+    TEST_ASSERT_FALSE(server.ping_ok());
+}
+
+static void test_hostname_too_long()
+{
+    char host[300];
+    memset(host, 'h', sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    FakeFluentd server;
+    FluentAuth auth(host, KEY);
+
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_NO_MEMORY, auth.handshake(&server));
+    TEST_ASSERT_EQUAL(0, server.get_sends());
+}
+
+static void test_replayed_pong()
+{
+    FakeFluentd first;
+    FluentAuth auth("device1", KEY);
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, auth.handshake(&first));
+
+    // same nonce, recorded PONG: the new salt does not match it
+    FakeFluentd second(NULL, first.get_pong(), first.get_pong_size());
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_AUTH_FAILURE, auth.handshake(&second));
+}
+#else
+static void test_no_trng()
+{
+    FakeFluentd server;
+    FluentAuth auth("device1", KEY);
+
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_UNSUPPORTED, auth.handshake(&server));
+    TEST_ASSERT_EQUAL(0, server.get_sends());
+}
+#endif
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+#if DEVICE_TRNG
+    Case("shared key handshake", test_shared_key),
+    Case("user auth with a PING larger than the buffer", test_user_auth_long_names),
+    Case("wrong password is rejected", test_wrong_password),
+    Case("hostname longer than a str8 is refused", test_hostname_too_long),
+    Case("replayed PONG is rejected", test_replayed_pong),
+#else
+    Case("shared key auth needs a TRNG", test_no_trng),
+#endif
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,111 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define HIGH 128
+#define LOW  32
+
+static uint8_t sent[2048];
+static int congested_calls;
+static int cleared_calls;
+
+static void on_watermark(bool congested)
+{
+    if (congested) {
+        congested_calls++;
+    } else {
+        cleared_calls++;
+    }
+}
+
+static void test_crossings()
+{
+    congested_calls = cleared_calls = 0;
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+    logger.set_batch(UINT32_MAX);
+    TEST_ASSERT_EQUAL(0, logger.set_watermarks(HIGH, LOW, on_watermark));
+
+    while (logger.get_queued_bytes() < HIGH) {
+        TEST_ASSERT_EQUAL(0, congested_calls);
+        TEST_ASSERT_EQUAL(0, logger.log("test.backpressure", "sample"));
+    }
+    TEST_ASSERT_EQUAL(1, congested_calls);
+
+    // staying above high does not repeat it
+    TEST_ASSERT_EQUAL(0, logger.log("test.backpressure", "sample"));
+    TEST_ASSERT_EQUAL(1, congested_calls);
+    TEST_ASSERT_EQUAL(0, cleared_calls);
+
+    // a failed flush keeps the buffer full
+    lo.set_error(NSAPI_ERROR_CONNECTION_LOST);
+    TEST_ASSERT_TRUE(logger.flush() < 0);
+    TEST_ASSERT_EQUAL(0, cleared_calls);
+
+    lo.set_error(NSAPI_ERROR_OK);
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    TEST_ASSERT_EQUAL(1, cleared_calls);
+    TEST_ASSERT_EQUAL(1, congested_calls);
+
+    // below high again: nothing until the next crossing
+    TEST_ASSERT_EQUAL(0, logger.log("test.backpressure", "sample"));
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    TEST_ASSERT_EQUAL(1, congested_calls);
+    TEST_ASSERT_EQUAL(1, cleared_calls);
+}
+
+static void test_bad_thresholds()
+{
+    congested_calls = cleared_calls = 0;
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+    logger.set_batch(UINT32_MAX);
+    TEST_ASSERT_EQUAL(0, logger.set_watermarks(HIGH, LOW, on_watermark));
+
+    TEST_ASSERT_EQUAL(-1, logger.set_watermarks(LOW, HIGH, on_watermark));
+    TEST_ASSERT_EQUAL(-1, logger.set_watermarks(HIGH, HIGH, on_watermark));
+    // disabling takes any thresholds
+    TEST_ASSERT_EQUAL(0, logger.set_watermarks(0, 0, mbed::Callback<void(bool)>()));
+    while (logger.get_queued_bytes() < HIGH) {
+        TEST_ASSERT_EQUAL(0, logger.log("test.backpressure", "sample"));
+    }
+    TEST_ASSERT_EQUAL(0, congested_calls);
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("one call crossing high, one dropping to low", test_crossings),
+    Case("low not below high is rejected", test_bad_thresholds),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
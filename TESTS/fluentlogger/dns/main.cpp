@@ -0,0 +1,205 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define TTL_MS 1000
+
+static uint64_t now_ms;
+
+static uint64_t sim_clock()
+{
+    return now_ms;
+}
+
+/* Counts lookups, answers with two fixed addresses or fails */
+class CountingNetwork : public NetworkInterface {
+public:
+    CountingNetwork() : lookups(0), fail(false) {}
+    virtual nsapi_error_t connect() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t disconnect() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t gethostbyname(const char *host, SocketAddress *address,
+                                        nsapi_version_t version = NSAPI_UNSPEC, const char *interface_name = NULL)
+    {
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+    virtual nsapi_value_or_error_t getaddrinfo(const char *host, SocketAddress *hints, SocketAddress **res,
+                                               const char *interface_name = NULL)
+    {
+        lookups++;
+        if (fail) {
+            return NSAPI_ERROR_DNS_FAILURE;
+        }
+        *res = new SocketAddress[2];
+        (*res)[0].set_ip_address("192.0.2.1");
+        (*res)[1].set_ip_address("192.0.2.2");
+        return 2;
+    }
+
+    int  lookups;
+    bool fail;
+
+protected:
+    virtual NetworkStack *get_stack() { return NULL; }
+};
+
+/* Accepts connections unless told to refuse them all */
+class FakeStream : public FluentTransport {
+public:
+    FakeStream() : connects(0), refuse(false) {}
+
+    virtual uint32_t capabilities() const { return CAP_STREAM | CAP_ADDRESS; }
+    virtual nsapi_error_t open() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t connect(const SocketAddress &addr)
+    {
+        connects++;
+        if (refuse) {
+            return NSAPI_ERROR_CONNECTION_TIMEOUT;
+        }
+        _connected = true;
+        return NSAPI_ERROR_OK;
+    }
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size) { return size; }
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size) { return NSAPI_ERROR_WOULD_BLOCK; }
+    virtual nsapi_error_t close() { _connected = false; return NSAPI_ERROR_OK; }
+
+    int  connects;
+    bool refuse;
+};
+
+/* A connection per message, so every log needs an address */
+static void setup(FluentLogger &logger)
+{
+    now_ms = 0;
+    logger.set_clock(sim_clock);
+    logger.set_persistent(false);
+    logger.set_dns_ttl(TTL_MS);
+}
+
+static void test_cache_hit()
+{
+    CountingNetwork net;
+    FakeStream stream;
+    FluentLogger logger(&stream, &net, "fluentd.example", 24224);
+    setup(logger);
+
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(0, logger.log("test.dns", "hit"));
+        now_ms += 100;
+    }
+    TEST_ASSERT_EQUAL(5, stream.connects);
+    TEST_ASSERT_EQUAL(1, net.lookups);
+}
+
+static void test_expiry()
+{
+    CountingNetwork net;
+    FakeStream stream;
+    FluentLogger logger(&stream, &net, "fluentd.example", 24224);
+    setup(logger);
+
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "first"));
+    TEST_ASSERT_EQUAL(1, net.lookups);
+    now_ms = TTL_MS - 1;
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "cached"));
+    TEST_ASSERT_EQUAL(1, net.lookups);
+    now_ms = TTL_MS;
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "expired"));
+    TEST_ASSERT_EQUAL(2, net.lookups);
+    // the lifetime starts again from the new lookup
+    now_ms = 2 * TTL_MS - 1;
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "cached"));
+    TEST_ASSERT_EQUAL(2, net.lookups);
+
+    // flush_dns() and a TTL of 0 force a lookup
+    logger.flush_dns();
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "flushed"));
+    TEST_ASSERT_EQUAL(3, net.lookups);
+    logger.set_dns_ttl(0);
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "uncached"));
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "uncached"));
+    TEST_ASSERT_EQUAL(5, net.lookups);
+}
+
+static void test_lookup_failure()
+{
+    CountingNetwork net;
+    FakeStream stream;
+    FluentLogger logger(&stream, &net, "fluentd.example", 24224);
+    setup(logger);
+
+    // a failed lookup is not cached, the message waits for the next try
+    net.fail = true;
+    TEST_ASSERT_TRUE(logger.log("test.dns", "waiting") < 0);
+    TEST_ASSERT_EQUAL(0, stream.connects);
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    TEST_ASSERT_TRUE(logger.flush() < 0);
+    TEST_ASSERT_EQUAL(2, net.lookups);
+
+    net.fail = false;
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    TEST_ASSERT_EQUAL(3, net.lookups);
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "cached"));
+    TEST_ASSERT_EQUAL(3, net.lookups);
+}
+
+static void test_all_addresses_fail()
+{
+    CountingNetwork net;
+    FakeStream stream;
+    FluentLogger logger(&stream, &net, "fluentd.example", 24224);
+    setup(logger);
+    TEST_ASSERT_EQUAL(0, logger.log("test.dns", "first"));
+    TEST_ASSERT_EQUAL(1, net.lookups);
+
+    // both cached addresses are tried, then the name is looked up again
+    stream.connects = 0;
+    stream.refuse = true;
+    TEST_ASSERT_TRUE(logger.log("test.dns", "refused") < 0);
+    TEST_ASSERT_EQUAL(2, stream.connects);
+    TEST_ASSERT_EQUAL(1, net.lookups);
+
+    stream.refuse = false;
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    TEST_ASSERT_EQUAL(2, net.lookups);
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("cached address is reused", test_cache_hit),
+    Case("cache expires after the TTL", test_expiry),
+    Case("failed lookup is retried", test_lookup_failure),
+    Case("unreachable addresses are looked up again", test_all_addresses_fail),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,224 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define INTERVAL_MS 20
+#define MISSES      3
+
+/* Resolves IP literals only, no network needed */
+class LiteralNetwork : public NetworkInterface {
+public:
+    virtual nsapi_error_t connect() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t disconnect() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t gethostbyname(const char *host, SocketAddress *address,
+                                        nsapi_version_t version = NSAPI_UNSPEC, const char *interface_name = NULL)
+    {
+        return address->set_ip_address(host) ? NSAPI_ERROR_OK : NSAPI_ERROR_DNS_FAILURE;
+    }
+    virtual nsapi_value_or_error_t getaddrinfo(const char *host, SocketAddress *hints, SocketAddress **res,
+                                               const char *interface_name = NULL)
+    {
+        *res = new SocketAddress[1];
+        (*res)[0].set_ip_address(host);
+        return 1;
+    }
+
+protected:
+    virtual NetworkStack *get_stack() { return NULL; }
+};
+
+/* Server side of the log connection */
+class FakeStream : public FluentTransport {
+public:
+    FakeStream() : connects(0), closed_by_server(false), unexpected(0) {}
+
+    virtual uint32_t capabilities() const { return CAP_STREAM | CAP_ADDRESS; }
+    virtual nsapi_error_t open() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t connect(const SocketAddress &addr) { connects++; _connected = true; return NSAPI_ERROR_OK; }
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size) { return size; }
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size)
+    {
+        if (closed_by_server) {
+            closed_by_server = false;
+            return 0;
+        }
+        if (unexpected > 0) {
+            uint32_t n = unexpected < size ? unexpected : size;
+            memset(data, 0, n);
+            unexpected -= n;
+            return n;
+        }
+        return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    virtual nsapi_error_t close() { _connected = false; return NSAPI_ERROR_OK; }
+
+    int      connects;
+    bool     closed_by_server;
+    uint32_t unexpected;
+};
+
+/* Heartbeat side: answers (or not) every heartbeat sent */
+class FakeProbe : public FluentTransport {
+public:
+    FakeProbe(bool answer) : answer(answer), connect_error(NSAPI_ERROR_OK), sent(0), pending(0), timeout(-1) {}
+
+    virtual uint32_t capabilities() const { return CAP_ADDRESS; }
+    virtual nsapi_error_t open() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t connect(const SocketAddress &addr)
+    {
+        _connected = connect_error == NSAPI_ERROR_OK;
+        return connect_error;
+    }
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size)
+    {
+        sent++;
+        if (answer) {
+            pending++;
+        }
+        return size;
+    }
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size)
+    {
+        // a blocking receive would stall poll()
+        TEST_ASSERT_EQUAL(0, timeout);
+        if (pending == 0) {
+            return NSAPI_ERROR_WOULD_BLOCK;
+        }
+        pending--;
+        *(uint8_t *)data = 0;
+        return 1;
+    }
+    virtual nsapi_error_t close() { _connected = false; return NSAPI_ERROR_OK; }
+    virtual void set_timeout(int timeout_ms) { timeout = timeout_ms; }
+
+    bool          answer;
+    nsapi_error_t connect_error;
+    int           sent;
+    int           pending;
+    int           timeout;
+};
+
+static LiteralNetwork net;
+
+/* poll() once per check interval, returns the longest poll() in ms */
+static uint32_t run_checks(FluentLogger &logger, int checks)
+{
+    uint32_t longest = 0;
+    for (int i = 0; i < checks; i++) {
+        wait_us((INTERVAL_MS + 2) * 1000);
+        uint64_t start = Kernel::get_ms_count();
+        logger.poll();
+        uint32_t ms = (uint32_t)(Kernel::get_ms_count() - start);
+        if (ms > longest) {
+            longest = ms;
+        }
+    }
+    return longest;
+}
+
+static void connect_logger(FluentLogger &logger)
+{
+    TEST_ASSERT_EQUAL(0, logger.log("test.health", "connect"));
+    TEST_ASSERT_EQUAL(0, logger.flush());
+}
+
+static void test_silent_server()
+{
+    FakeStream stream;
+    FakeProbe probe(false);
+    FluentLogger logger(&stream, &net, "192.0.2.1", 24224, 256);
+    connect_logger(logger);
+    logger.set_health_check(INTERVAL_MS, &probe, MISSES);
+
+    // the first heartbeat has nothing to miss yet
+    uint32_t longest = run_checks(logger, MISSES);
+    TEST_ASSERT_EQUAL(0, logger.get_stats().failovers);
+    longest += run_checks(logger, 1);
+    TEST_ASSERT_EQUAL(1, logger.get_stats().failovers);
+    TEST_ASSERT_EQUAL(2, stream.connects);
+    TEST_ASSERT_LESS_THAN(INTERVAL_MS, longest);
+}
+
+static void test_answering_server()
+{
+    FakeStream stream;
+    FakeProbe probe(true);
+    FluentLogger logger(&stream, &net, "192.0.2.1", 24224, 256);
+    connect_logger(logger);
+    logger.set_health_check(INTERVAL_MS, &probe, MISSES);
+
+    run_checks(logger, 3 * MISSES);
+    TEST_ASSERT_EQUAL(0, logger.get_stats().failovers);
+    TEST_ASSERT_EQUAL(3 * MISSES, probe.sent);
+}
+
+static void test_probe_connect_fails()
+{
+    FakeStream stream;
+    FakeProbe probe(true);
+    probe.connect_error = NSAPI_ERROR_NO_SOCKET;
+    FluentLogger logger(&stream, &net, "192.0.2.1", 24224, 256);
+    connect_logger(logger);
+    logger.set_health_check(INTERVAL_MS, &probe, MISSES);
+
+    run_checks(logger, MISSES);
+    TEST_ASSERT_EQUAL(0, probe.sent);
+    TEST_ASSERT_EQUAL(1, logger.get_stats().failovers);
+}
+
+static void test_closed_connection()
+{
+    FakeStream stream;
+    FluentLogger logger(&stream, &net, "192.0.2.1", 24224, 256);
+    connect_logger(logger);
+    logger.set_health_check(INTERVAL_MS);
+
+    stream.unexpected = 40;
+    run_checks(logger, 3);
+    TEST_ASSERT_EQUAL(0, logger.get_stats().failovers);
+
+    stream.closed_by_server = true;
+    run_checks(logger, 1);
+    TEST_ASSERT_EQUAL(1, logger.get_stats().failovers);
+    TEST_ASSERT_EQUAL(2, stream.connects);
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("silent server fails over without blocking poll()", test_silent_server),
+    Case("answered heartbeats keep the connection", test_answering_server),
+    Case("probe connect() failures count as misses", test_probe_connect_fails),
+    Case("closed connection is replaced, stray data is not", test_closed_connection),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
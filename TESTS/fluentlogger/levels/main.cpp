@@ -0,0 +1,121 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+static uint8_t sent[1024];
+static int evaluated;
+
+static int count_evaluation()
+{
+    return ++evaluated;
+}
+
+/* One record of each level for a tag, returns how many were queued */
+static uint32_t log_all_levels(FluentLogger &logger, const char *tag)
+{
+    uint32_t before = logger.get_queued_records();
+    FLUENT_DEBUG(logger, tag, "%d", count_evaluation());
+    FLUENT_INFO(logger, tag, "%d", count_evaluation());
+    FLUENT_WARN(logger, tag, "%d", count_evaluation());
+    FLUENT_ERROR(logger, tag, "%d", count_evaluation());
+    return logger.get_queued_records() - before;
+}
+
+static void test_tag_level_at_run_time()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+    logger.set_batch(UINT32_MAX);
+    logger.set_level(FLUENT_LEVEL_WARN);
+
+    evaluated = 0;
+    TEST_ASSERT_EQUAL(2, log_all_levels(logger, "test.sensor"));
+    TEST_ASSERT_EQUAL(2, log_all_levels(logger, "test.other"));
+    // disabled calls do not evaluate their arguments
+    TEST_ASSERT_EQUAL(4, evaluated);
+
+    TEST_ASSERT_EQUAL(0, logger.set_level("test.sensor", FLUENT_LEVEL_DEBUG));
+    TEST_ASSERT_EQUAL(4, log_all_levels(logger, "test.sensor"));
+    TEST_ASSERT_EQUAL(2, log_all_levels(logger, "test.other"));
+
+    TEST_ASSERT_EQUAL(0, logger.set_level("test.sensor", FLUENT_LEVEL_NONE));
+    TEST_ASSERT_EQUAL(0, log_all_levels(logger, "test.sensor"));
+    TEST_ASSERT_EQUAL(2, log_all_levels(logger, "test.other"));
+
+    logger.set_level(FLUENT_LEVEL_ERROR);
+    TEST_ASSERT_EQUAL(0, log_all_levels(logger, "test.sensor"));
+    TEST_ASSERT_EQUAL(1, log_all_levels(logger, "test.other"));
+}
+
+static void test_registered_tag_level()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+    logger.set_batch(UINT32_MAX);
+    int tag = logger.register_tag("test.sensor");
+    TEST_ASSERT_TRUE(tag >= 0);
+
+    uint32_t before = logger.get_queued_records();
+    FLUENT_DEBUG(logger, tag, "%d", 1);
+    FLUENT_INFO(logger, tag, "%d", 2);
+    TEST_ASSERT_EQUAL(2, logger.get_queued_records() - before);
+
+    // the handle picks up a later change
+    TEST_ASSERT_EQUAL(0, logger.set_level("test.sensor", FLUENT_LEVEL_INFO));
+    before = logger.get_queued_records();
+    FLUENT_DEBUG(logger, tag, "%d", 1);
+    FLUENT_INFO(logger, tag, "%d", 2);
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records() - before);
+}
+
+static void test_plain_log_unfiltered()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+    logger.set_batch(UINT32_MAX);
+    logger.set_level(FLUENT_LEVEL_NONE);
+
+    TEST_ASSERT_EQUAL(0, logger.log("test.sensor", "plain"));
+    TEST_ASSERT_EQUAL(0, logger.logf("test.sensor", "%s", "formatted"));
+    TEST_ASSERT_EQUAL(2, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(0, log_all_levels(logger, "test.sensor"));
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("tag level changed at run time", test_tag_level_at_run_time),
+    Case("registered tag follows its level", test_registered_tag_level),
+    Case("log() and logf() are not filtered", test_plain_log_unfiltered),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
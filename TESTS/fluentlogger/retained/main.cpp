@@ -0,0 +1,154 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define RECORDS 3
+
+/* The retained region: a "reset" is a new logger over the same bytes */
+static uint32_t region[128];
+static uint8_t sent[1024];
+static uint8_t expected[1024];
+
+/* What the first n records look like on the wire, sent without the region */
+static uint32_t encode_expected(int n)
+{
+    FluentLoopbackTransport lo(expected, sizeof(expected));
+    FluentLogger logger(&lo);
+    for (int i = 0; i < n; i++) {
+        TEST_ASSERT_EQUAL(0, logger.logf("test.retained", "record %d", i));
+    }
+    return lo.get_size();
+}
+
+/* Log RECORDS records into a cleared region, then "reset" */
+static void log_before_reset()
+{
+    memset(region, 0, sizeof(region));
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    TEST_ASSERT_EQUAL(0, logger.set_retained(region, sizeof(region)));
+    logger.set_batch(UINT32_MAX);
+    for (int i = 0; i < RECORDS; i++) {
+        TEST_ASSERT_EQUAL(0, logger.logf("test.retained", "record %d", i));
+    }
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+}
+
+/* Flip a byte of a record's text inside the region */
+static void corrupt_record(int i)
+{
+    char text[16];
+    int n = sprintf(text, "record %d", i);
+    uint8_t *p = (uint8_t *)region;
+    for (uint32_t off = 0; off + n <= sizeof(region); off++) {
+        if (memcmp(p + off, text, n) == 0) {
+            p[off + n - 1] ^= 0x40;
+            return;
+        }
+    }
+    TEST_FAIL_MESSAGE("record not found in the region");
+}
+
+/* Boot over the region and send what was recovered */
+static int boot_and_flush(uint32_t *size)
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_batch(UINT32_MAX);
+    int records = logger.set_retained(region, sizeof(region));
+    TEST_ASSERT_EQUAL(records < 0 ? 0 : records, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(0, logger.flush());
+    *size = lo.get_size();
+
+    // the region keeps working after the recovery
+    TEST_ASSERT_EQUAL(0, logger.log("test.retained", "after"));
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    return records;
+}
+
+static void test_recover()
+{
+    log_before_reset();
+
+    uint32_t size;
+    TEST_ASSERT_EQUAL(RECORDS, boot_and_flush(&size));
+    TEST_ASSERT_EQUAL(encode_expected(RECORDS), size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, sent, size);
+}
+
+static void test_torn_newest_slot()
+{
+    log_before_reset();
+    // the last record is only covered by the newest slot
+    corrupt_record(RECORDS - 1);
+
+    uint32_t size;
+    TEST_ASSERT_EQUAL(RECORDS - 1, boot_and_flush(&size));
+    TEST_ASSERT_EQUAL(encode_expected(RECORDS - 1), size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, sent, size);
+}
+
+static void test_bad_crc_rejected()
+{
+    log_before_reset();
+    // the first record is covered by both slots, neither CRC matches
+    corrupt_record(0);
+
+    uint32_t size;
+    TEST_ASSERT_EQUAL(0, boot_and_flush(&size));
+    TEST_ASSERT_EQUAL(0, size);
+}
+
+static void test_cold_boot()
+{
+    // power-on contents are random
+    memset(region, 0xa5, sizeof(region));
+
+    uint32_t size;
+    TEST_ASSERT_EQUAL(0, boot_and_flush(&size));
+    TEST_ASSERT_EQUAL(0, size);
+
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    TEST_ASSERT_EQUAL(-1, logger.set_retained(region, 8));
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("records survive a reset", test_recover),
+    Case("torn newest slot falls back to the other", test_torn_newest_slot),
+    Case("region with a bad CRC is not replayed", test_bad_crc_rejected),
+    Case("cold boot and a too small region", test_cold_boot),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,168 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentScheduler.h"
+
+using namespace utest::v1;
+
+#define PERIOD 10000
+#define WINDOW 500
+#define HOLD   30000
+
+static uint8_t sent[4096];
+
+/* Simulated clock of the logger, nothing sleeps */
+static uint64_t now_ms;
+
+static uint64_t sim_clock()
+{
+    return now_ms;
+}
+
+static void test_window()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 1024);
+    logger.set_clock(sim_clock);
+    FluentScheduler sched(&logger);
+    // window from 21000 to 21500, 31000 to 31500, ...
+    sched.set_duty_cycle(PERIOD, WINDOW, 1000);
+
+    now_ms = 20000;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "x"));
+    TEST_ASSERT_EQUAL(20000, logger.get_queued_since());
+
+    now_ms = 20999;
+    TEST_ASSERT_FALSE(sched.is_due(now_ms));
+    TEST_ASSERT_EQUAL(1, sched.next_wakeup(now_ms));
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+
+    now_ms = 21000;
+    TEST_ASSERT_EQUAL(0, sched.next_wakeup(now_ms));
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+    TEST_ASSERT_GREATER_THAN(0, lo.get_size());
+    TEST_ASSERT_EQUAL(1, sched.get_bursts());
+
+    // nothing queued: wait for the next window instead of spinning in this one
+    TEST_ASSERT_EQUAL(PERIOD - 100, sched.next_wakeup(21100));
+
+    // logged inside the window: sent by the next poll
+    now_ms = 21400;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "y"));
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+
+    // past the window it waits for the next one
+    now_ms = 21500;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "z"));
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(PERIOD - WINDOW, sched.next_wakeup(now_ms));
+    TEST_ASSERT_EQUAL(2, sched.get_bursts());
+}
+
+static void test_max_hold()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 1024);
+    logger.set_clock(sim_clock);
+    FluentScheduler sched(&logger, HOLD);
+
+    now_ms = 5000;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "x"));
+    now_ms = 6000;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "y"));
+
+    // the first poll comes late, the hold still counts from the oldest record
+    now_ms = 5000 + HOLD - 1000;
+    TEST_ASSERT_EQUAL(1000, sched.next_wakeup(now_ms));
+    now_ms = 5000 + HOLD - 1;
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(2, logger.get_queued_records());
+    now_ms = 5000 + HOLD;
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+
+    TEST_ASSERT_EQUAL(UINT32_MAX, sched.next_wakeup(now_ms));
+}
+
+static void test_link_up_and_urgent()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 1024);
+    logger.set_clock(sim_clock);
+    FluentScheduler sched(&logger, HOLD);
+
+    now_ms = 1000;
+    TEST_ASSERT_EQUAL(0, logger.log("test", "x"));
+    now_ms = 1001;
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    sched.set_link_up(true);
+    TEST_ASSERT_EQUAL(0, sched.next_wakeup(now_ms));
+    TEST_ASSERT_EQUAL(0, sched.poll());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+
+    sched.set_link_up(false);
+    TEST_ASSERT_EQUAL(0, logger.log("test", "alarm"));
+    TEST_ASSERT_EQUAL(0, sched.urgent());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(2, sched.get_bursts());
+}
+
+static void test_adaptive_off()
+{
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo, NULL, NULL, 24224, 1024);
+    logger.set_clock(sim_clock);
+    logger.set_adaptive(16, 512, 1000);
+    FluentScheduler sched(&logger);
+
+    // a send must not retune the thresholds the scheduler relies on
+    TEST_ASSERT_EQUAL(0, logger.log("test", "x"));
+    TEST_ASSERT_EQUAL(0, sched.urgent());
+    TEST_ASSERT_EQUAL(0, logger.log("test", "y"));
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    FluentLogger::Stats stats = logger.get_stats();
+    TEST_ASSERT_EQUAL(UINT32_MAX, stats.batch_bytes);
+    TEST_ASSERT_EQUAL(0, stats.flush_interval_ms);
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("burst inside a wake window", test_window),
+    Case("max hold counts from the oldest record", test_max_hold),
+    Case("link up and urgent", test_link_up_and_urgent),
+    Case("scheduler turns adaptive tuning off", test_adaptive_off),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
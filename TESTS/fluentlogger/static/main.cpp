@@ -0,0 +1,102 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+/* Stream transport that accepts everything and needs no address, so no DNS */
+class NullTransport : public FluentTransport {
+public:
+    NullTransport(NetworkInterface *net) : _bytes(0) {}
+
+    virtual uint32_t capabilities() const { return CAP_STREAM; }
+    virtual nsapi_error_t open() { return NSAPI_ERROR_OK; }
+    virtual nsapi_error_t connect(const SocketAddress &addr) { _connected = true; return NSAPI_ERROR_OK; }
+    virtual nsapi_size_or_error_t send(const void *data, uint32_t size) { _bytes += size; return size; }
+    virtual nsapi_size_or_error_t recv(void *data, uint32_t size) { return NSAPI_ERROR_WOULD_BLOCK; }
+    virtual nsapi_error_t close() { _connected = false; return NSAPI_ERROR_OK; }
+
+    uint32_t get_bytes() const { return _bytes; }
+
+private:
+    uint32_t _bytes;
+};
+
+static void test_footprint()
+{
+    MBED_STATIC_ASSERT(StaticFluentLogger<512>::footprint() == sizeof(StaticFluentLogger<512>), "footprint");
+    MBED_STATIC_ASSERT(StaticFluentLogger<1024>::footprint() == StaticFluentLogger<512>::footprint() + 512,
+                       "only the message buffer depends on BUFSIZE");
+}
+
+static void test_no_allocation()
+{
+#if MBED_HEAP_STATS_ENABLED
+    mbed_stats_heap_t before, after;
+    mbed_stats_heap_get(&before);
+    {
+        StaticFluentLogger<256, NullTransport> logger(NULL, NULL);
+        logger.set_batch(128);
+        int tag = logger.register_tag("test.static");
+        TEST_ASSERT_TRUE(tag >= 0);
+
+        uint8_t buf[64];
+        uMP mp(buf, sizeof(buf));
+        for (int i = 0; i < 100; i++) {
+            TEST_ASSERT_EQUAL(0, logger.log("test.static", "message"));
+            TEST_ASSERT_EQUAL(0, logger.logf(tag, "count=%d", i));
+            mp.init();
+            mp.start_map(2);
+            mp.map("seq", (uint32_t)i);
+            mp.map("state", "ok");
+            TEST_ASSERT_EQUAL(0, logger.log(tag, mp));
+        }
+        TEST_ASSERT_EQUAL(0, logger.flush());
+        FluentLogger::Stats stats = logger.get_stats();
+        TEST_ASSERT_EQUAL(300, stats.records_sent);
+        TEST_ASSERT_EQUAL(0, stats.records_dropped);
+        TEST_ASSERT_GREATER_THAN(1, stats.sends);
+    }
+    mbed_stats_heap_get(&after);
+    // total_size only grows, so an allocation freed again still shows
+    TEST_ASSERT_EQUAL(before.total_size, after.total_size);
+#else
+    TEST_IGNORE_MESSAGE("needs platform.heap-stats-enabled");
+#endif
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("footprint depends on BUFSIZE only", test_footprint),
+    Case("construct, log and flush without allocating", test_no_allocation),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,134 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentStripedLogger.h"
+
+using namespace utest::v1;
+
+static const char *const tags[8] = {
+    "bench.a", "bench.b", "bench.c", "bench.d", "bench.e", "bench.f", "bench.g", "bench.h"
+};
+
+static uint8_t sent[2][4096];
+
+static void test_round_robin()
+{
+    FluentLoopbackTransport lo0(sent[0], sizeof(sent[0])), lo1(sent[1], sizeof(sent[1]));
+    FluentLogger lane0(&lo0, NULL, NULL, 24224, 512), lane1(&lo1, NULL, NULL, 24224, 512);
+    FluentStripedLogger striped(FluentStripedLogger::POLICY_ROUND_ROBIN);
+    TEST_ASSERT_EQUAL(0, striped.add_lane(&lane0));
+    TEST_ASSERT_EQUAL(1, striped.add_lane(&lane1));
+
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(i % 2, striped.lane_of(tags[i]));
+    }
+    // a copy of a known tag is found by content
+    char copy[16];
+    strcpy(copy, tags[1]);
+    TEST_ASSERT_EQUAL(1, striped.lane_of(copy));
+
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(0, striped.logf(tags[i % 4], "record %d", i));
+    }
+    TEST_ASSERT_EQUAL(0, striped.flush());
+    TEST_ASSERT_EQUAL(5, striped.get_stats(0).records_sent);
+    TEST_ASSERT_EQUAL(5, striped.get_stats(1).records_sent);
+}
+
+static void test_hash_is_stable()
+{
+    FluentLoopbackTransport lo0(sent[0], sizeof(sent[0])), lo1(sent[1], sizeof(sent[1]));
+    FluentLogger lane0(&lo0, NULL, NULL, 24224, 512), lane1(&lo1, NULL, NULL, 24224, 512);
+    FluentStripedLogger striped;
+    striped.add_lane(&lane0);
+    striped.add_lane(&lane1);
+
+    for (int i = 0; i < 8; i++) {
+        int lane = striped.lane_of(tags[i]);
+        TEST_ASSERT_TRUE(lane == 0 || lane == 1);
+        TEST_ASSERT_EQUAL(lane, striped.lane_of(tags[i]));
+    }
+}
+
+/* Throughput over 1, 2 and 4 lanes against tools/test/slow-fluentd.py,
+ * which reads 16 KiB per connection every 50 ms like a long round trip.
+ * Set fluent-bench-host (and fluent-bench-port) in mbed_app.json. */
+static void bench_lanes()
+{
+#ifdef MBED_CONF_APP_FLUENT_BENCH_HOST
+#ifndef MBED_CONF_APP_FLUENT_BENCH_PORT
+#define MBED_CONF_APP_FLUENT_BENCH_PORT 24224
+#endif
+    NetworkInterface *net = NetworkInterface::get_default_instance();
+    TEST_ASSERT_TRUE(net != NULL);
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, net->connect());
+
+    for (int nlanes = 1; nlanes <= 4; nlanes *= 2) {
+        FluentLogger *lanes[4];
+        FluentStripedLogger striped(FluentStripedLogger::POLICY_ROUND_ROBIN);
+        for (int i = 0; i < nlanes; i++) {
+            lanes[i] = new FluentLogger(net, MBED_CONF_APP_FLUENT_BENCH_HOST, MBED_CONF_APP_FLUENT_BENCH_PORT, 2048);
+            lanes[i]->set_persistent(true);
+            lanes[i]->set_batch(1536);
+            striped.add_lane(lanes[i]);
+        }
+
+        uint32_t records = 0;
+        uint64_t start = Kernel::get_ms_count();
+        while (Kernel::get_ms_count() - start < 5000) {
+            for (int k = 0; k < 8; k++) {
+                striped.logf(tags[k], "record %lu with some telemetry payload padding", (unsigned long)records++);
+            }
+        }
+        striped.flush();
+        uint32_t ms = (uint32_t)(Kernel::get_ms_count() - start);
+
+        printf("lanes=%d: %lu records/s", nlanes, (unsigned long)((uint64_t)records * 1000 / ms));
+        for (int i = 0; i < nlanes; i++) {
+            FluentLogger::Stats stats = striped.get_stats(i);
+            printf(" [lane%d sends=%lu errors=%lu]", i, (unsigned long)stats.sends, (unsigned long)stats.send_errors);
+            delete lanes[i];
+        }
+        printf("\n");
+    }
+    net->disconnect();
+#else
+    TEST_IGNORE_MESSAGE("set fluent-bench-host to run the benchmark");
+#endif
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("round robin lanes", test_round_robin),
+    Case("hash lanes are stable", test_hash_is_stable),
+    Case("throughput over 1, 2 and 4 lanes", bench_lanes),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
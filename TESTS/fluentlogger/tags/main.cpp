@@ -0,0 +1,152 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+#include <time.h>
+
+using namespace utest::v1;
+
+static uint8_t by_name[512];
+static uint8_t by_handle[512];
+
+/* fixstr, the longest fixstr and the shortest str8 tag */
+static const char *tags[3] = {
+    "test.tags",
+    "test.tags.aaaaaaaaaaaaaaaaaaaaaa",
+    "test.tags.aaaaaaaaaaaaaaaaaaaaaaa",
+};
+
+/* The u32 timestamp behind the tag */
+static uint32_t get_timestamp(const uint8_t *record, uint32_t size)
+{
+    uMPReader rd(record, size);
+    uint32_t n;
+    const char *s;
+    uint64_t t;
+    TEST_ASSERT_TRUE(rd.get_array(&n));
+    TEST_ASSERT_TRUE(rd.get_str(&s, &n));
+    TEST_ASSERT_EQUAL_HEX8(0xce, record[rd.get_pos()]);
+    TEST_ASSERT_TRUE(rd.get_uint(&t));
+    return (uint32_t)t;
+}
+
+/* Log the same message by name and by handle, in the same second */
+static void compare(const char *tag, int handle, int variant)
+{
+    for (int attempt = 0; attempt < 3; attempt++) {
+        FluentLoopbackTransport a(by_name, sizeof(by_name));
+        FluentLoopbackTransport b(by_handle, sizeof(by_handle));
+        FluentLogger named(&a);
+        FluentLogger registered(&b);
+        TEST_ASSERT_EQUAL(handle, registered.register_tag(tag));
+
+        uMP msg(64);
+        msg.start_map(1);
+        msg.set_str("value", 5);
+        msg.set_sint(-42);
+
+        time_t before = time(NULL);
+        switch (variant) {
+            case 0:
+                TEST_ASSERT_EQUAL(0, named.log(tag, "message"));
+                TEST_ASSERT_EQUAL(0, registered.log(handle, "message"));
+                break;
+            case 1:
+                TEST_ASSERT_EQUAL(0, named.logf(tag, "%s %d", "message", 42));
+                TEST_ASSERT_EQUAL(0, registered.logf(handle, "%s %d", "message", 42));
+                break;
+            default:
+                TEST_ASSERT_EQUAL(0, named.log(tag, msg));
+                TEST_ASSERT_EQUAL(0, registered.log(handle, msg));
+                break;
+        }
+        if (time(NULL) != before) {
+            continue;  // a second boundary between the two, try again
+        }
+
+        TEST_ASSERT_EQUAL(a.get_size(), b.get_size());
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(by_name, by_handle, a.get_size());
+#ifdef USE_NTP
+        // the cached header got the current time patched in
+        TEST_ASSERT_EQUAL((uint32_t)before, get_timestamp(by_handle, b.get_size()));
+#else
+        TEST_ASSERT_EQUAL(0, get_timestamp(by_handle, b.get_size()));
+#endif
+        return;
+    }
+    TEST_FAIL_MESSAGE("clock keeps changing");
+}
+
+static void test_log_string()
+{
+#ifdef USE_NTP
+    set_time(1700000000);
+#endif
+    for (int i = 0; i < 3; i++) {
+        compare(tags[i], 0, 0);
+    }
+}
+
+static void test_logf()
+{
+    for (int i = 0; i < 3; i++) {
+        compare(tags[i], 0, 1);
+    }
+}
+
+static void test_log_ump()
+{
+    for (int i = 0; i < 3; i++) {
+        compare(tags[i], 0, 2);
+    }
+}
+
+static void test_handles()
+{
+    FluentLoopbackTransport lo(by_handle, sizeof(by_handle));
+    FluentLogger logger(&lo);
+    TEST_ASSERT_EQUAL(0, logger.register_tag(tags[0]));
+    TEST_ASSERT_EQUAL(1, logger.register_tag(tags[1]));
+    // registering again returns the same handle
+    TEST_ASSERT_EQUAL(0, logger.register_tag(tags[0]));
+    TEST_ASSERT_EQUAL(-1, logger.log(2, "unknown"));
+    TEST_ASSERT_EQUAL(-1, logger.log(-1, "unknown"));
+    TEST_ASSERT_EQUAL(0, lo.get_size());
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("log() by handle matches log() by name", test_log_string),
+    Case("logf() by handle matches logf() by name", test_logf),
+    Case("log(uMP) by handle matches log(uMP) by name", test_log_ump),
+    Case("handles are reused and checked", test_handles),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
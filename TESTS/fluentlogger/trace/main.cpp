@@ -0,0 +1,111 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentTrace.h"
+#include "mbed_trace.h"
+
+#define TRACE_GROUP "TEST"
+
+using namespace utest::v1;
+
+static uint8_t sent[4096];
+static FluentLogger *shared;
+static bool busy_seen;
+
+static void test_forward()
+{
+#if MBED_CONF_MBED_TRACE_ENABLE
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_batch(UINT32_MAX);
+    FluentTraceBridge bridge(&logger, "test.trace");
+    bridge.install();
+
+    tr_info("one");
+    tr_warn("two");
+    TEST_ASSERT_EQUAL(2, logger.get_queued_records());
+
+    // the logger's own diagnostics while sending are not fed back
+    logger.set_batch(0);
+    tr_info("three");
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+    TEST_ASSERT_EQUAL(3, logger.get_stats().records_sent);
+    bridge.uninstall();
+#else
+    TEST_IGNORE_MESSAGE("needs mbed-trace.enable");
+#endif
+}
+
+static void trace_from_thread()
+{
+    busy_seen = shared->is_busy();
+    tr_info("from another thread");
+}
+
+static void test_other_thread()
+{
+#if MBED_CONF_MBED_TRACE_ENABLE && MBED_CONF_RTOS_PRESENT
+    FluentLoopbackTransport lo(sent, sizeof(sent));
+    FluentLogger logger(&lo);
+    logger.set_batch(UINT32_MAX);
+    FluentTraceBridge bridge(&logger, "test.trace");
+    bridge.install();
+    shared = &logger;
+
+    // inside the logger for this thread only: the other one is not busy,
+    // its line is dropped and counted instead of waiting
+    logger.lock();
+    Thread t1;
+    t1.start(callback(trace_from_thread));
+    t1.join();
+    logger.unlock();
+    TEST_ASSERT_FALSE(busy_seen);
+    TEST_ASSERT_EQUAL(1, bridge.get_dropped());
+    TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+
+    Thread t2;
+    t2.start(callback(trace_from_thread));
+    t2.join();
+    TEST_ASSERT_EQUAL(1, bridge.get_dropped());
+    TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+    bridge.uninstall();
+#else
+    TEST_IGNORE_MESSAGE("needs mbed-trace.enable and an RTOS");
+#endif
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    mbed_trace_init();
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("trace lines become records", test_forward),
+    Case("lines from other threads never wait for the logger", test_other_thread),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,177 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "FluentLogger.h"
+
+using namespace utest::v1;
+
+#define GATHER    (FluentTransport::CAP_STREAM | FluentTransport::CAP_GATHER | FluentTransport::CAP_ZERO_COPY)
+#define ZERO_COPY (FluentTransport::CAP_STREAM | FluentTransport::CAP_ZERO_COPY)
+#define COPY      (FluentTransport::CAP_STREAM)
+
+static uint8_t sent[4096];
+static uint8_t payload[512];
+
+/* A map with one binary field of n bytes */
+static void make_message(uMP &mp, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        payload[i] = (uint8_t)i;
+    }
+    mp.init();
+    TEST_ASSERT_TRUE(mp.start_map(1));
+    TEST_ASSERT_TRUE(mp.set_str("data", 4));
+    TEST_ASSERT_TRUE(mp.set_bin(payload, n));
+}
+
+/* The wire format of one message: [tag, time, msg], the time is not compared */
+static void check_sent(const FluentLoopbackTransport &lo, const char *tag, uMP &msg)
+{
+    uint8_t buf[64];
+    uMP header(buf, sizeof(buf));
+    header.start_array(3);
+    header.set_str(tag, strlen(tag));
+    header.set_u32(0);
+    uint32_t n = header.get_size();
+
+    TEST_ASSERT_EQUAL(n + msg.get_size(), lo.get_size());
+    TEST_ASSERT_EQUAL_MEMORY(buf, lo.get_buffer(), n - 4);
+    TEST_ASSERT_EQUAL_MEMORY(msg.get_buffer(), lo.get_buffer() + n, msg.get_size());
+}
+
+static void test_send_paths()
+{
+    const uint32_t caps[3] = { GATHER, ZERO_COPY, COPY };
+    // the message is sent in one gathered write, behind the header, or copied
+    const uint32_t writes[3] = { 1, 2, 1 };
+    uMP msg(256);
+    make_message(msg, 100);
+
+    for (int i = 0; i < 3; i++) {
+        FluentLoopbackTransport lo(sent, sizeof(sent));
+        lo.set_capabilities(caps[i]);
+        FluentLogger logger(&lo, NULL, NULL, 24224, 512);
+        TEST_ASSERT_EQUAL(0, logger.log("test.transport", msg));
+        check_sent(lo, "test.transport", msg);
+        TEST_ASSERT_EQUAL(writes[i], lo.get_writes());
+        TEST_ASSERT_EQUAL(0, logger.get_queued_bytes());
+
+        // batches go out as one buffer on every path
+        lo.clear();
+        logger.set_batch(1024);
+        TEST_ASSERT_EQUAL(0, logger.log("test.transport", msg));
+        TEST_ASSERT_EQUAL(0, logger.log("test.transport", msg));
+        TEST_ASSERT_EQUAL(0, logger.flush());
+        TEST_ASSERT_EQUAL(1, lo.get_writes());
+        TEST_ASSERT_EQUAL(3, logger.get_stats().records_sent);
+    }
+}
+
+static void test_larger_than_buffer()
+{
+    const uint32_t caps[3] = { GATHER, ZERO_COPY, COPY };
+    uMP msg(600);
+    make_message(msg, 500);
+
+    for (int i = 0; i < 3; i++) {
+        FluentLoopbackTransport lo(sent, sizeof(sent));
+        lo.set_capabilities(caps[i]);
+        FluentLogger logger(&lo, NULL, NULL, 24224, 128);
+        if (caps[i] == COPY) {
+            // has to fit into the message buffer
+            TEST_ASSERT_EQUAL(-1, logger.log("test.transport", msg));
+            TEST_ASSERT_EQUAL(1, logger.get_stats().records_dropped);
+            TEST_ASSERT_EQUAL(0, lo.get_size());
+        } else {
+            TEST_ASSERT_EQUAL(0, logger.log("test.transport", msg));
+            check_sent(lo, "test.transport", msg);
+        }
+    }
+}
+
+static void test_failed_send_keeps_message()
+{
+    const uint32_t caps[3] = { GATHER, ZERO_COPY, COPY };
+    uMP msg(256);
+    make_message(msg, 50);
+
+    for (int i = 0; i < 3; i++) {
+        FluentLoopbackTransport lo(sent, sizeof(sent));
+        lo.set_capabilities(caps[i]);
+        FluentLogger logger(&lo, NULL, NULL, 24224, 256);
+        lo.set_error(NSAPI_ERROR_CONNECTION_LOST);
+        TEST_ASSERT_TRUE(logger.log("test.transport", msg) < 0);
+        TEST_ASSERT_EQUAL(1, logger.get_queued_records());
+
+        lo.set_error(NSAPI_ERROR_OK);
+        TEST_ASSERT_EQUAL(0, logger.flush());
+        check_sent(lo, "test.transport", msg);
+        TEST_ASSERT_EQUAL(0, logger.get_queued_records());
+    }
+}
+
+/* Unbatched log(tag, uMP &) rate on each path, nothing but the logger
+ * and a memcpy into the loopback buffer */
+static void bench_send_paths()
+{
+    const uint32_t caps[3] = { GATHER, ZERO_COPY, COPY };
+    const char *names[3] = { "gather", "zero-copy", "copy" };
+    uMP msg(256);
+    make_message(msg, 200);
+
+    for (int i = 0; i < 3; i++) {
+        FluentLoopbackTransport lo(sent, sizeof(sent));
+        lo.set_capabilities(caps[i]);
+        FluentLogger logger(&lo, NULL, NULL, 24224, 256);
+
+        uint32_t records = 0;
+        uint64_t start = Kernel::get_ms_count();
+        while (Kernel::get_ms_count() - start < 1000) {
+            for (int k = 0; k < 100; k++) {
+                lo.clear();
+                logger.log("bench.transport", msg);
+            }
+            records += 100;
+        }
+        uint32_t ms = (uint32_t)(Kernel::get_ms_count() - start);
+        printf("%-10s %lu records/s\n", names[i], (unsigned long)((uint64_t)records * 1000 / ms));
+        TEST_ASSERT_EQUAL(records, logger.get_stats().records_sent);
+    }
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("gather, zero-copy and copy send paths", test_send_paths),
+    Case("messages larger than the buffer skip it", test_larger_than_buffer),
+    Case("failed direct send keeps the message", test_failed_send_keeps_message),
+    Case("send path throughput", bench_send_paths),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
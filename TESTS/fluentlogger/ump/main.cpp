@@ -0,0 +1,361 @@
+/* fluent-logger-mbed
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include "uMP.h"
+#include <math.h>
+#include <float.h>
+
+using namespace utest::v1;
+
+/* Not a multiple of any block size, so the tail loop runs too */
+#define N 19
+
+static float floats[N];
+static int16_t s16s[N];
+static uint32_t u32s[N];
+
+static void fill()
+{
+    for (int i = 0; i < N; i++) {
+        floats[i] = (i - 9) * 1.25f;
+        s16s[i] = (int16_t)(i * 0x1357 - 0x4000);
+        u32s[i] = 0x01020304u * (i + 1);
+    }
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+
+static void test_arrays()
+{
+    fill();
+    uMP mp(512);
+    TEST_ASSERT_TRUE(mp.set_float_array(floats, N));
+    TEST_ASSERT_TRUE(mp.set_s16_array(s16s, N));
+    TEST_ASSERT_TRUE(mp.set_u32_array(u32s, N));
+
+    uMPReader rd(mp.get_buffer(), mp.get_size());
+    uint32_t n;
+    TEST_ASSERT_TRUE(rd.get_array(&n));
+    TEST_ASSERT_EQUAL(N, n);
+    for (int i = 0; i < N; i++) {
+        // no float getter: float32 is 0xca and the big endian bits
+        const uint8_t *p;
+        uint32_t size;
+        TEST_ASSERT_TRUE(rd.skip(&p, &size));
+        TEST_ASSERT_EQUAL(5, size);
+        TEST_ASSERT_EQUAL_HEX8(0xca, p[0]);
+        TEST_ASSERT_EQUAL_HEX32(bits(floats[i]), be32(p + 1));
+    }
+
+    TEST_ASSERT_TRUE(rd.get_array(&n));
+    TEST_ASSERT_EQUAL(N, n);
+    for (int i = 0; i < N; i++) {
+        int64_t v;
+        TEST_ASSERT_TRUE(rd.get_sint(&v));
+        TEST_ASSERT_EQUAL(s16s[i], v);
+    }
+
+    TEST_ASSERT_TRUE(rd.get_array(&n));
+    TEST_ASSERT_EQUAL(N, n);
+    for (int i = 0; i < N; i++) {
+        uint64_t v;
+        TEST_ASSERT_TRUE(rd.get_uint(&v));
+        TEST_ASSERT_EQUAL(u32s[i], v);
+    }
+    TEST_ASSERT_EQUAL(0, rd.get_remaining());
+}
+
+static void test_bins()
+{
+    fill();
+    uMP mp(512);
+    TEST_ASSERT_TRUE(mp.set_float_bin(floats, N));
+    TEST_ASSERT_TRUE(mp.set_s16_bin(s16s, N));
+    TEST_ASSERT_TRUE(mp.set_u32_bin(u32s, N));
+
+    uMPReader rd(mp.get_buffer(), mp.get_size());
+    const uint8_t *p;
+    uint32_t size;
+    TEST_ASSERT_TRUE(rd.get_bin(&p, &size));
+    TEST_ASSERT_EQUAL(4 * N, size);
+    for (int i = 0; i < N; i++) {
+        TEST_ASSERT_EQUAL_HEX32(bits(floats[i]), be32(p + 4 * i));
+    }
+
+    TEST_ASSERT_TRUE(rd.get_bin(&p, &size));
+    TEST_ASSERT_EQUAL(2 * N, size);
+    for (int i = 0; i < N; i++) {
+        TEST_ASSERT_EQUAL_HEX16((uint16_t)s16s[i], (p[2 * i] << 8) | p[2 * i + 1]);
+    }
+
+    TEST_ASSERT_TRUE(rd.get_bin(&p, &size));
+    TEST_ASSERT_EQUAL(4 * N, size);
+    for (int i = 0; i < N; i++) {
+        TEST_ASSERT_EQUAL_HEX32(u32s[i], be32(p + 4 * i));
+    }
+    TEST_ASSERT_EQUAL(0, rd.get_remaining());
+}
+
+/* Every length up to a few blocks, from an unaligned source */
+static void test_lengths_and_alignment()
+{
+    uint8_t src[4 * 40 + 1];
+    for (uint32_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)i;
+    }
+    for (uint32_t n = 0; n <= 40; n++) {
+        uMP mp(256);
+        TEST_ASSERT_TRUE(mp.set_u32_bin((const uint32_t *)(src + 1), n));
+        TEST_ASSERT_TRUE(mp.set_s16_bin((const int16_t *)(src + 1), n));
+
+        uMPReader rd(mp.get_buffer(), mp.get_size());
+        const uint8_t *p;
+        uint32_t size;
+        TEST_ASSERT_TRUE(rd.get_bin(&p, &size));
+        TEST_ASSERT_EQUAL(4 * n, size);
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t v;
+            memcpy(&v, src + 1 + 4 * i, 4);
+            TEST_ASSERT_EQUAL_HEX32(v, be32(p + 4 * i));
+        }
+        TEST_ASSERT_TRUE(rd.get_bin(&p, &size));
+        TEST_ASSERT_EQUAL(2 * n, size);
+        for (uint32_t i = 0; i < n; i++) {
+            uint16_t v;
+            memcpy(&v, src + 1 + 2 * i, 2);
+            TEST_ASSERT_EQUAL_HEX16(v, (p[2 * i] << 8) | p[2 * i + 1]);
+        }
+    }
+}
+
+static void test_buffer_full()
+{
+    fill();
+    uint8_t buf[64];
+    uMP mp(buf, sizeof(buf));
+    TEST_ASSERT_TRUE(mp.set_str("head", 4));
+    uint32_t size = mp.get_size();
+
+    // 19 values need more than the 59 bytes left in every form
+    TEST_ASSERT_FALSE(mp.set_float_array(floats, N));
+    TEST_ASSERT_FALSE(mp.set_s16_array(s16s, N));
+    TEST_ASSERT_FALSE(mp.set_u32_array(u32s, N));
+    TEST_ASSERT_FALSE(mp.set_float_bin(floats, N));
+    TEST_ASSERT_FALSE(mp.set_u32_bin(u32s, N));
+    TEST_ASSERT_EQUAL(size, mp.get_size());
+
+    // what fits still goes in behind the untouched head
+    TEST_ASSERT_TRUE(mp.set_s16_bin(s16s, N));
+    uMPReader rd(mp.get_buffer(), mp.get_size());
+    const char *s;
+    uint32_t n;
+    TEST_ASSERT_TRUE(rd.get_str(&s, &n));
+    TEST_ASSERT_EQUAL_MEMORY("head", s, 4);
+    const uint8_t *p;
+    TEST_ASSERT_TRUE(rd.get_bin(&p, &n));
+    TEST_ASSERT_EQUAL(2 * N, n);
+}
+
+/* fixstr, str8 and str16 at their limits */
+static void test_str_lengths()
+{
+    static char text[300];
+    for (uint32_t i = 0; i < sizeof(text); i++) {
+        text[i] = 'a' + i % 26;
+    }
+    const uint32_t lengths[5] = { 31, 32, 255, 256, 300 };
+    const uint8_t tags[5] = { 0xbf, 0xd9, 0xd9, 0xda, 0xda };
+    const uint32_t headers[5] = { 1, 2, 2, 3, 3 };
+
+    for (int i = 0; i < 5; i++) {
+        uMP mp(512);
+        TEST_ASSERT_TRUE(mp.set_str(text, lengths[i]));
+        TEST_ASSERT_EQUAL(headers[i] + lengths[i], mp.get_size());
+        TEST_ASSERT_EQUAL_HEX8(tags[i], mp.get_buffer()[0]);
+
+        uMPReader rd(mp.get_buffer(), mp.get_size());
+        const char *s;
+        uint32_t n;
+        TEST_ASSERT_TRUE(rd.get_str(&s, &n));
+        TEST_ASSERT_EQUAL(lengths[i], n);
+        TEST_ASSERT_EQUAL_MEMORY(text, s, n);
+        TEST_ASSERT_EQUAL(0, rd.get_remaining());
+    }
+
+    // one byte short: nothing is written
+    uint8_t buf[258];
+    uMP mp(buf, sizeof(buf));
+    TEST_ASSERT_TRUE(mp.set_str("head", 4));
+    TEST_ASSERT_FALSE(mp.set_str(text, 256));
+    TEST_ASSERT_EQUAL(5, mp.get_size());
+}
+
+/* First byte and length of a single encoded value */
+struct Encoding {
+    uint8_t tag;
+    uint32_t size;
+};
+
+static void expect(uMP &mp, uint8_t tag, uint32_t size)
+{
+    Encoding e = { tag, size };
+    TEST_ASSERT_EQUAL(e.size, mp.get_size());
+    // positive and negative fixints are their own tag
+    TEST_ASSERT_EQUAL_HEX8(e.tag, mp.get_buffer()[0] & (e.size == 1 && e.tag < 0x80 ? 0x80 : 0xff));
+}
+
+static void test_compact_int_boundaries()
+{
+    const uint64_t u[10] = { 127, 128, 255, 256, 65535, 65536, 0xffffffffULL, 0x100000000ULL, UINT64_MAX, 0 };
+    const Encoding eu[10] = {
+        { 0x00, 1 }, { 0xcc, 2 }, { 0xcc, 2 }, { 0xcd, 3 }, { 0xcd, 3 },
+        { 0xce, 5 }, { 0xce, 5 }, { 0xcf, 9 }, { 0xcf, 9 }, { 0x00, 1 },
+    };
+    for (int i = 0; i < 10; i++) {
+        uMP mp(16);
+        mp.set_compact(uMP::COMPACT_INT);
+        TEST_ASSERT_TRUE(mp.set_u64(u[i]));
+        expect(mp, eu[i].tag, eu[i].size);
+        uMPReader rd(mp.get_buffer(), mp.get_size());
+        uint64_t v;
+        TEST_ASSERT_TRUE(rd.get_uint(&v));
+        TEST_ASSERT_TRUE(v == u[i]);
+    }
+
+    const int64_t s[10] = { -1, -32, -33, -128, -129, -32768, -32769, INT32_MIN, (int64_t)INT32_MIN - 1, INT64_MIN };
+    const Encoding es[10] = {
+        { 0xe0, 1 }, { 0xe0, 1 }, { 0xd0, 2 }, { 0xd0, 2 }, { 0xd1, 3 },
+        { 0xd1, 3 }, { 0xd2, 5 }, { 0xd2, 5 }, { 0xd3, 9 }, { 0xd3, 9 },
+    };
+    for (int i = 0; i < 10; i++) {
+        uMP mp(16);
+        mp.set_compact(uMP::COMPACT_INT);
+        TEST_ASSERT_TRUE(mp.set_s64(s[i]));
+        TEST_ASSERT_EQUAL(es[i].size, mp.get_size());
+        TEST_ASSERT_EQUAL_HEX8(es[i].tag, mp.get_buffer()[0] & (es[i].size == 1 ? 0xe0 : 0xff));
+        uMPReader rd(mp.get_buffer(), mp.get_size());
+        int64_t v;
+        TEST_ASSERT_TRUE(rd.get_sint(&v));
+        TEST_ASSERT_TRUE(v == s[i]);
+    }
+
+    // narrower setters take the same path, without compaction they keep their width
+    uMP mp(16);
+    mp.set_compact(uMP::COMPACT_INT);
+    TEST_ASSERT_TRUE(mp.set_s32(-33));
+    TEST_ASSERT_EQUAL(2, mp.get_size());
+    mp.init();
+    mp.set_compact(uMP::COMPACT_NONE);
+    TEST_ASSERT_TRUE(mp.set_u32(1));
+    expect(mp, 0xce, 5);
+}
+
+static void test_compact_float_boundaries()
+{
+    // float32 keeps integers exactly up to 2^24
+    const float f[6] = { 16777215.0f, 16777216.0f, -16777215.0f, 0.5f, -0.0f, NAN };
+    const Encoding ef[6] = { { 0xce, 5 }, { 0xca, 5 }, { 0xd2, 5 }, { 0xca, 5 }, { 0xca, 5 }, { 0xca, 5 } };
+    for (int i = 0; i < 6; i++) {
+        uMP mp(16);
+        mp.set_compact(uMP::COMPACT_LOSSLESS);
+        TEST_ASSERT_TRUE(mp.set_float(f[i]));
+        expect(mp, ef[i].tag, ef[i].size);
+    }
+}
+
+static void test_compact_double_boundaries()
+{
+    struct {
+        double d;
+        Encoding lossless;
+        Encoding lossy;
+    } cases[13] = {
+        // double keeps integers exactly below 2^53
+        { 9007199254740991.0,  { 0xcf, 9 }, { 0xcf, 9 } },
+        { -9007199254740991.0, { 0xd3, 9 }, { 0xd3, 9 } },
+        { 9007199254740992.0,  { 0xca, 5 }, { 0xca, 5 } },
+        { 21.0,                { 0x00, 1 }, { 0x00, 1 } },
+        { 0.25,                { 0xca, 5 }, { 0xca, 5 } },
+        { 0.1,                 { 0xcb, 9 }, { 0xca, 5 } },
+        { -0.0,                { 0xca, 5 }, { 0xca, 5 } },
+        { FLT_MAX,             { 0xca, 5 }, { 0xca, 5 } },
+        // outside the float range: never converted, not even lossy
+        { 3.5e38,              { 0xcb, 9 }, { 0xcb, 9 } },
+        { -1e300,              { 0xcb, 9 }, { 0xcb, 9 } },
+        { DBL_MAX,             { 0xcb, 9 }, { 0xcb, 9 } },
+        { INFINITY,            { 0xca, 5 }, { 0xca, 5 } },
+        { NAN,                 { 0xca, 5 }, { 0xca, 5 } },
+    };
+    for (int i = 0; i < 13; i++) {
+        uMP mp(16);
+        mp.set_compact(uMP::COMPACT_LOSSLESS);
+        TEST_ASSERT_TRUE(mp.set_double(cases[i].d));
+        expect(mp, cases[i].lossless.tag, cases[i].lossless.size);
+
+        uMP lossy(16);
+        lossy.set_compact(uMP::COMPACT_LOSSLESS | uMP::COMPACT_LOSSY_FLOAT);
+        TEST_ASSERT_TRUE(lossy.set_double(cases[i].d));
+        expect(lossy, cases[i].lossy.tag, cases[i].lossy.size);
+    }
+
+    // a value too small for float32 only becomes one when lossy
+    uMP mp(16);
+    mp.set_compact(uMP::COMPACT_LOSSLESS);
+    TEST_ASSERT_TRUE(mp.set_double(1e-50));
+    expect(mp, 0xcb, 9);
+    mp.init();
+    mp.set_compact(uMP::COMPACT_LOSSY_FLOAT);
+    TEST_ASSERT_TRUE(mp.set_double(1e-50));
+    expect(mp, 0xca, 5);
+}
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("typed arrays decode to the input", test_arrays),
+    Case("packed binaries are big endian", test_bins),
+    Case("every length, unaligned source", test_lengths_and_alignment),
+    Case("full buffer leaves the message unchanged", test_buffer_full),
+    Case("strings of 31, 255 and 256 bytes", test_str_lengths),
+    Case("compact integers at type boundaries", test_compact_int_boundaries),
+    Case("compact floats at type boundaries", test_compact_float_boundaries),
+    Case("compact doubles, out of float range included", test_compact_double_boundaries),
+};
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,138 @@
+/* fluent-relay-bench - load generator for fluent-relay
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Opens many device-like connections and sends FluentLogger style
+ * [tag, time, record] messages as fast as possible. The relay itself
+ * reports records/sec per worker (core); this prints what was offered.
+ *
+ *   usage: fluent-relay-bench [-c connections] [-d seconds] [-t tags] [-b batch] <host> [port]
+ */
+
+#include "uMP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const char *g_host;
+static const char *g_port = "24224";
+static int g_tags = 8;
+static int g_batch = 100;
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_records(0);
+
+static int connect_relay()
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(g_host, g_port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void client(int id)
+{
+    int fd = connect_relay();
+    if (fd < 0) {
+        fprintf(stderr, "connection %d failed\n", id);
+        return;
+    }
+
+    // one batch of messages, like a FluentLogger flush
+    uMP mp(64 * 1024);
+    char tag[32];
+    for (int i = 0; i < g_batch; i++) {
+        snprintf(tag, sizeof(tag), "bench.tag%d", (id + i) % g_tags);
+        mp.start_array(3);
+        mp.set_str(tag, strlen(tag));
+        mp.set_u32(0);
+        mp.start_map(3);
+        mp.map("id", (uint32_t)id);
+        mp.map("seq", (uint32_t)i);
+        mp.map("value", 21.5f);
+    }
+
+    while (!g_stop) {
+        const uint8_t *p = mp.get_buffer();
+        uint32_t n = mp.get_size();
+        while (n > 0) {
+            ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                close(fd);
+                return;
+            }
+            p += w;
+            n -= w;
+        }
+        g_records += g_batch;
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    int conns = 64;
+    int duration = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:t:b:")) != -1) {
+        switch (opt) {
+            case 'c': conns = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 't': g_tags = atoi(optarg); break;
+            case 'b': g_batch = atoi(optarg); break;
+            default: argc = 0; break;
+        }
+    }
+    if (argc - optind < 1 || g_tags <= 0 || g_batch <= 0) {
+        fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-t tags] [-b batch] <host> [port]\n", argv[0]);
+        return 1;
+    }
+    g_host = argv[optind];
+    if (argc - optind > 1) {
+        g_port = argv[optind + 1];
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < conns; i++) {
+        threads.push_back(std::thread(client, i));
+    }
+    sleep(duration);
+    g_stop = true;
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    printf("%d connections: %.0f rec/s offered\n", conns, (double)g_records / duration);
+    return 0;
+}
@@ -0,0 +1,540 @@
+/* fluent-relay - multi-core Forward protocol aggregation relay
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Accepts device connections speaking the Forward protocol (Message mode,
+ * as sent by FluentLogger), and re-batches their records per tag into
+ * PackedForward chunks for the upstream fluentd.
+ *
+ * Every worker thread owns a SO_REUSEPORT listener, an epoll set, its
+ * per-tag chunks and an upstream connection, so workers share nothing.
+ * Record bodies are never decoded: uMPReader only finds their extent
+ * and they are copied once into the chunk, which is sent as is. The
+ * exception are delta encoded batches (FluentDeltaEncoder), which are
+ * expanded into plain records.
+ *
+ *   usage: fluent-relay [-l port] [-w workers] [-c chunk_bytes] [-f flush_ms] [-s stats_s] <host|-> [port]
+ *
+ * An upstream host of "-" discards the output (for benchmarking).
+ */
+
+#include "uMP.h"
+#include "FluentDelta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define MAX_TAGS        1024            // per worker, power of two
+#define MAX_TAG_LEN     255
+#define RX_BUFSIZE      (64 * 1024)
+#define RX_MAXSIZE      (8 * 1024 * 1024)
+
+struct Config {
+    int         listen_port;
+    int         workers;
+    uint32_t    chunk_bytes;
+    int         flush_ms;
+    int         stats_s;
+    const char  *host;
+    const char  *port;
+};
+
+static Config g_cfg = { 24224, 0, 1024 * 1024, 1000, 5, NULL, "24224" };
+
+/* Per-tag PackedForward chunk: concatenated [time, record] entries */
+struct Chunk {
+    char                 tag[MAX_TAG_LEN];
+    uint32_t             ntag;
+    uint32_t             hash;
+    uint32_t             count;
+    int64_t              first_ms;
+    std::vector<uint8_t> data;
+};
+
+struct Conn {
+    int                  fd;
+    std::vector<uint8_t> buf;
+    uint32_t             len;
+};
+
+struct Worker {
+    int                    id;
+    int                    epfd;
+    int                    lfd;
+    int                    upstream;
+    Chunk                  *tags[MAX_TAGS];
+    std::vector<Chunk *>   active;
+    std::atomic<uint64_t>  records;
+    std::atomic<uint64_t>  chunks;
+    std::atomic<uint64_t>  dropped;
+};
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t fnv1a(const char *s, uint32_t n)
+{
+    uint32_t h = 2166136261u;
+    while (n--) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+/* Upstream */
+static int connect_upstream()
+{
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rt = getaddrinfo(g_cfg.host, g_cfg.port, &hints, &res);
+    if (rt != 0) {
+        fprintf(stderr, "%s: %s\n", g_cfg.host, gai_strerror(rt));
+        return -1;
+    }
+    int fd = -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        // writev() with MSG_NOSIGNAL: a closed upstream must not raise SIGPIPE
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool send_upstream(Worker *w, struct iovec *iov, int iovcnt)
+{
+    if (g_cfg.host == NULL) {
+        return true;
+    }
+    // one reconnect per chunk, fluentd may have restarted
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (w->upstream < 0) {
+            w->upstream = connect_upstream();
+            if (w->upstream < 0) {
+                return false;
+            }
+        }
+        struct iovec copy[4];
+        memcpy(copy, iov, iovcnt * sizeof(struct iovec));
+        if (writev_all(w->upstream, copy, iovcnt)) {
+            return true;
+        }
+        close(w->upstream);
+        w->upstream = -1;
+    }
+    return false;
+}
+
+/* Chunks */
+static void flush_chunk(Worker *w, Chunk *c)
+{
+    if (c->count == 0) {
+        return;
+    }
+    // [tag, bin(entries), {"size": count}], entries sent from the chunk buffer
+    uint8_t head_buf[MAX_TAG_LEN + 16];
+    uint8_t tail_buf[16];
+    uMP head(head_buf, sizeof(head_buf));
+    uMP tail(tail_buf, sizeof(tail_buf));
+    head.start_array(3);
+    head.set_str(c->tag, c->ntag);
+    head.start_bin((uint32_t)c->data.size());
+    tail.start_map(1);
+    tail.set_str("size", 4);
+    tail.set_uint(c->count);
+
+    struct iovec iov[3] = {
+        { head.get_buffer(), head.get_size() },
+        { c->data.data(), c->data.size() },
+        { tail.get_buffer(), tail.get_size() },
+    };
+    if (send_upstream(w, iov, 3)) {
+        w->chunks++;
+    } else {
+        w->dropped += c->count;
+    }
+    c->count = 0;
+    c->data.clear();
+}
+
+static Chunk *find_chunk(Worker *w, const char *tag, uint32_t ntag)
+{
+    uint32_t h = fnv1a(tag, ntag);
+    for (uint32_t i = 0; i < MAX_TAGS; i++) {
+        uint32_t slot = (h + i) & (MAX_TAGS - 1);
+        Chunk *c = w->tags[slot];
+        if (c == NULL) {
+            c = new Chunk;
+            memcpy(c->tag, tag, ntag);
+            c->ntag = ntag;
+            c->hash = h;
+            c->count = 0;
+            c->data.reserve(g_cfg.chunk_bytes);
+            w->tags[slot] = c;
+            return c;
+        }
+        if (c->hash == h && c->ntag == ntag && memcmp(c->tag, tag, ntag) == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void add_record(Worker *w, const char *tag, uint32_t ntag,
+                       const uint8_t *time, uint32_t ntime, const uint8_t *rec, uint32_t nrec);
+
+/* Expand a delta encoded batch into plain records */
+static void add_delta(Worker *w, const char *tag, uint32_t ntag, const uint8_t *data, uint32_t size)
+{
+    FluentDeltaDecoder dec(data, size);
+    // an expanded record is at most the batch plus widened integers
+    std::vector<uint8_t> buf(2 * size + 9 * FLUENT_DELTA_MAX_KEYS + 16);
+    uMP out(buf.data(), buf.size());
+    uint8_t tbuf[5];
+    uint32_t t;
+    for (;;) {
+        out.init();
+        if (!dec.next(&t, out)) {
+            break;
+        }
+        uMP tmp(tbuf, sizeof(tbuf));
+        tmp.set_u32(t);
+        add_record(w, tag, ntag, tbuf, tmp.get_size(), out.get_buffer(), out.get_size());
+    }
+    if (!dec.is_valid() || dec.has_more()) {
+        w->dropped++;   // malformed, or a record larger than buf
+    }
+}
+
+static void add_record(Worker *w, const char *tag, uint32_t ntag,
+                       const uint8_t *time, uint32_t ntime, const uint8_t *rec, uint32_t nrec)
+{
+    uMPReader r(rec, nrec);
+    int8_t type;
+    const uint8_t *ext;
+    uint32_t next;
+    if (r.get_ext(&type, &ext, &next) && type == FLUENT_DELTA_EXT_TYPE) {
+        add_delta(w, tag, ntag, ext, next);
+        return;
+    }
+
+    Chunk *c = find_chunk(w, tag, ntag);
+    if (c == NULL) {
+        w->dropped++;   // tag table full
+        return;
+    }
+    if (c->count == 0) {
+        c->first_ms = now_ms();
+        w->active.push_back(c);
+    }
+
+    // [time, record]; devices without a clock send 0, stamp on arrival
+    uint8_t hdr[8];
+    uMP mp(hdr, sizeof(hdr));
+    mp.start_array(2);
+    uMPReader t(time, ntime);
+    uint64_t tv;
+    if (t.get_uint(&tv) && tv == 0) {
+        mp.set_u32((uint32_t)::time(NULL));
+        time = NULL;
+    }
+    c->data.insert(c->data.end(), hdr, hdr + mp.get_size());
+    if (time) {
+        c->data.insert(c->data.end(), time, time + ntime);
+    }
+    c->data.insert(c->data.end(), rec, rec + nrec);
+    c->count++;
+    w->records++;
+
+    if (c->data.size() >= g_cfg.chunk_bytes) {
+        flush_chunk(w, c);
+    }
+}
+
+static void flush_expired(Worker *w, bool all)
+{
+    int64_t now = now_ms();
+    size_t keep = 0;
+    for (size_t i = 0; i < w->active.size(); i++) {
+        Chunk *c = w->active[i];
+        if (c->count > 0 && (all || now - c->first_ms >= g_cfg.flush_ms)) {
+            flush_chunk(w, c);
+        }
+        if (c->count > 0) {
+            w->active[keep++] = c;
+        }
+    }
+    w->active.resize(keep);
+}
+
+/* Parse complete messages from a connection buffer, returns bytes used or -1 */
+static long parse(Worker *w, const uint8_t *data, uint32_t len)
+{
+    uMPReader rd(data, len);
+    for (;;) {
+        uint32_t start = rd.get_pos();
+        const uint8_t *msg;
+        uint32_t nmsg;
+        // need one complete object before looking into it
+        if (!rd.skip(&msg, &nmsg)) {
+            return start;
+        }
+
+        uMPReader m(msg, nmsg);
+        uint32_t nelem;
+        const char *tag;
+        uint32_t ntag;
+        const uint8_t *time, *rec;
+        uint32_t ntime, nrec;
+        if (!m.get_array(&nelem) || nelem < 3 || nelem > 4 || !m.get_str(&tag, &ntag) || ntag > MAX_TAG_LEN
+            || !m.skip(&time, &ntime) || !m.skip(&rec, &nrec)) {
+            // only Message mode is supported
+            return -1;
+        }
+        add_record(w, tag, ntag, time, ntime, rec, nrec);
+    }
+}
+
+static void conn_close(Worker *w, Conn *c)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    delete c;
+}
+
+static void conn_read(Worker *w, Conn *c)
+{
+    for (;;) {
+        if (c->len == c->buf.size()) {
+            if (c->buf.size() >= RX_MAXSIZE) {
+                fprintf(stderr, "worker %d: message too large, closing\n", w->id);
+                conn_close(w, c);
+                return;
+            }
+            c->buf.resize(c->buf.size() * 2);
+        }
+        ssize_t n = read(c->fd, c->buf.data() + c->len, c->buf.size() - c->len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            conn_close(w, c);
+            return;
+        }
+        c->len += n;
+
+        long used = parse(w, c->buf.data(), c->len);
+        if (used < 0) {
+            fprintf(stderr, "worker %d: malformed message, closing\n", w->id);
+            conn_close(w, c);
+            return;
+        }
+        memmove(c->buf.data(), c->buf.data() + used, c->len - used);
+        c->len -= used;
+    }
+}
+
+static int listen_socket(int port)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    int zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // each worker gets its own listener, the kernel spreads connections
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void worker_main(Worker *w)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->id % std::thread::hardware_concurrency(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;     // NULL marks the listener
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->lfd, &ev);
+
+    struct epoll_event events[64];
+    for (;;) {
+        int timeout = w->active.empty() ? -1 : g_cfg.flush_ms / 4 + 1;
+        int n = epoll_wait(w->epfd, events, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            Conn *c = (Conn *)events[i].data.ptr;
+            if (c == NULL) {
+                int fd;
+                while ((fd = accept4(w->lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    c = new Conn;
+                    c->fd = fd;
+                    c->buf.resize(RX_BUFSIZE);
+                    c->len = 0;
+                    ev.events = EPOLLIN | EPOLLRDHUP;
+                    ev.data.ptr = c;
+                    epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+            conn_read(w, c);
+        }
+        flush_expired(w, false);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "l:w:c:f:s:")) != -1) {
+        switch (opt) {
+            case 'l': g_cfg.listen_port = atoi(optarg); break;
+            case 'w': g_cfg.workers = atoi(optarg); break;
+            case 'c': g_cfg.chunk_bytes = strtoul(optarg, NULL, 10); break;
+            case 'f': g_cfg.flush_ms = atoi(optarg); break;
+            case 's': g_cfg.stats_s = atoi(optarg); break;
+            default: argc = 0; break;
+        }
+    }
+    if (argc - optind < 1) {
+        fprintf(stderr, "usage: %s [-l port] [-w workers] [-c chunk_bytes] [-f flush_ms] [-s stats_s] <host|-> [port]\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[optind], "-") != 0) {
+        g_cfg.host = argv[optind];
+    }
+    if (argc - optind > 1) {
+        g_cfg.port = argv[optind + 1];
+    }
+    if (g_cfg.workers <= 0) {
+        g_cfg.workers = std::thread::hardware_concurrency();
+    }
+    if (g_cfg.flush_ms <= 0) {
+        g_cfg.flush_ms = 1;
+    }
+
+    std::vector<Worker *> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < g_cfg.workers; i++) {
+        Worker *w = new Worker();
+        w->id = i;
+        w->epfd = epoll_create1(0);
+        w->lfd = listen_socket(g_cfg.listen_port);
+        w->upstream = -1;
+        w->records = 0;
+        w->chunks = 0;
+        w->dropped = 0;
+        if (w->lfd < 0) {
+            perror("listen");
+            return 1;
+        }
+        workers.push_back(w);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        threads.push_back(std::thread(worker_main, workers[i]));
+    }
+
+    // records/sec per worker (core)
+    std::vector<uint64_t> last(workers.size(), 0);
+    int64_t t0 = now_ms();
+    for (;;) {
+        sleep(g_cfg.stats_s > 0 ? g_cfg.stats_s : 5);
+        if (g_cfg.stats_s <= 0) {
+            continue;
+        }
+        int64_t t1 = now_ms();
+        double sec = (t1 - t0) / 1000.0;
+        uint64_t total = 0;
+        for (size_t i = 0; i < workers.size(); i++) {
+            uint64_t r = workers[i]->records;
+            fprintf(stderr, "worker %zu: %.0f rec/s, %llu chunks, %llu dropped\n", i, (r - last[i]) / sec,
+                    (unsigned long long)workers[i]->chunks.load(), (unsigned long long)workers[i]->dropped.load());
+            total += r - last[i];
+            last[i] = r;
+        }
+        fprintf(stderr, "total: %.0f rec/s\n", total / sec);
+        t0 = t1;
+    }
+}
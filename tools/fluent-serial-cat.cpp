@@ -0,0 +1,75 @@
+/* fluent-serial-cat - send a test message as a serial frame
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Host side stand-in for a device using FluentSerialTransport, e.g. on
+ * one end of a pty pair with fluent-serial-relay on the other.
+ *
+ *   usage: fluent-serial-cat <tty> <tag> <message> [count]
+ */
+
+#include "uMP.h"
+#include "FluentFrame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int output(void *ctx, const uint8_t *data, uint32_t size)
+{
+    int fd = *(int *)ctx;
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <tty> <tag> <message> [count]\n", argv[0]);
+        return 1;
+    }
+    int count = (argc > 4) ? atoi(argv[4]) : 1;
+    int fd = open(argv[1], O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // same layout as FluentLogger::log(tag, msg), batched into one frame
+    uMP mp(64 * 1024);
+    for (int i = 0; i < count; i++) {
+        if (!mp.start_array(3) || !mp.set_str(argv[2], strlen(argv[2]))
+            || !mp.set_u32(0) || !mp.set_str(argv[3], strlen(argv[3]))) {
+            fprintf(stderr, "message too large\n");
+            return 1;
+        }
+    }
+
+    FluentFrameEncoder enc(output, &fd);
+    if (enc.begin(0) != 0 || enc.write(mp.get_buffer(), mp.get_size()) != 0 || enc.end() != 0) {
+        perror("write");
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
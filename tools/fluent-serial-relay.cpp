@@ -0,0 +1,398 @@
+/* fluent-serial-relay - forward framed serial logs to fluentd
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Reads FluentSerialTransport frames from a tty and sends their
+ * messages to fluentd in Forward mode, one [tag, [[time, record], ...]]
+ * entry per run of messages with the same tag. Delta encoded batches
+ * (FluentDeltaEncoder) are expanded into plain records.
+ *
+ *   usage: fluent-serial-relay [-b baud] <tty> <host> [port]
+ */
+
+#include "uMP.h"
+#include "FluentFrame.h"
+#include "FluentDelta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define MAX_FRAME   (64 * 1024)
+#define MAX_CHUNK   (MAX_FRAME * 2)
+
+static const char *g_host;
+static const char *g_port = "24224";
+static int g_sock = -1;
+
+/* Forward mode chunk under construction: [tag, [[time, record], ...]]
+ * runs, one per run of messages with the same tag. A run is opened with
+ * an array32 placeholder whose count is patched when it is closed, so
+ * entries are encoded straight into the chunk as they are parsed. */
+static uMP g_out(MAX_CHUNK);
+static bool g_open;             // a run is open
+static uint32_t g_run_at;       // offset of the open run
+static uint32_t g_count_at;     // offset of its entry count
+static uint32_t g_time_at;      // offset of the time of the last begun entry
+static const char *g_tag;       // tag of the open run
+static uint32_t g_ntag;
+static uint32_t g_nrun;         // entries in the open run
+static uint32_t g_nchunk;       // entries in the chunk
+static uint32_t g_now;          // arrival time of the frame
+
+static speed_t to_speed(long baud)
+{
+    switch (baud) {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        default:      return 0;
+    }
+}
+
+static int open_tty(const char *path, long baud)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        speed_t speed = to_speed(baud);
+        if (speed) {
+            cfsetispeed(&tio, speed);
+            cfsetospeed(&tio, speed);
+        }
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static int connect_upstream()
+{
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rt = getaddrinfo(g_host, g_port, &hints, &res);
+    if (rt != 0) {
+        fprintf(stderr, "%s: %s\n", g_host, gai_strerror(rt));
+        return -1;
+    }
+    int fd = -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "could not connect to %s:%s\n", g_host, g_port);
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const uint8_t *data, uint32_t size)
+{
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool send_upstream(const uint8_t *data, uint32_t size)
+{
+    // one reconnect per batch, fluentd may have restarted
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (g_sock < 0) {
+            g_sock = connect_upstream();
+            if (g_sock < 0) {
+                return false;
+            }
+        }
+        if (send_all(g_sock, data, size)) {
+            return true;
+        }
+        close(g_sock);
+        g_sock = -1;
+    }
+    return false;
+}
+
+/* Patch the entry count of the open run */
+static void close_run()
+{
+    if (!g_open) {
+        return;
+    }
+    uint8_t *p = g_out.get_buffer() + g_count_at;
+    p[0] = g_nrun >> 24;
+    p[1] = g_nrun >> 16;
+    p[2] = g_nrun >> 8;
+    p[3] = g_nrun;
+    g_open = false;
+}
+
+/* Send the chunk (messages are dropped if fluentd cannot be reached) */
+static void send_chunk()
+{
+    close_run();
+    if (g_nchunk > 0 && !send_upstream(g_out.get_buffer(), g_out.get_size())) {
+        fprintf(stderr, "upstream send failed, %u message(s) dropped\n", g_nchunk);
+    }
+    g_out.init();
+    g_nchunk = 0;
+}
+
+/* Drop an entry begun with begin_entry() (and the run it opened) */
+static void abort_entry(uint32_t mark)
+{
+    g_out.rewind(mark);
+    if (mark <= g_run_at) {
+        g_open = false;
+    }
+}
+
+/* Start a [time, record] entry in the run of tag, opening a new run if
+ * the tag changed; the record is appended by the caller
+ * @retval false chunk full, nothing written */
+static bool begin_entry(const char *tag, uint32_t ntag, uint64_t time, uint32_t *mark)
+{
+    *mark = g_out.get_size();
+    if (!g_open || g_ntag != ntag || memcmp(g_tag, tag, ntag) != 0) {
+        close_run();
+        static const char count[5] = { (char)0xdd, 0, 0, 0, 0 };    // array32
+        if (!g_out.start_array(2) || !g_out.set_str(tag, ntag) || !g_out.set_raw(count, sizeof(count))) {
+            g_out.rewind(*mark);
+            return false;
+        }
+        g_run_at = *mark;
+        g_count_at = g_out.get_size() - 4;
+        g_tag = tag;
+        g_ntag = ntag;
+        g_nrun = 0;
+        g_open = true;
+    }
+    // devices without a clock send 0, stamp on arrival
+    if (!g_out.start_array(2) || !g_out.set_u32(time ? (uint32_t)time : g_now)) {
+        abort_entry(*mark);
+        return false;
+    }
+    g_time_at = g_out.get_size() - 4;
+    return true;
+}
+
+/* Account an entry completed after begin_entry() */
+static void end_entry()
+{
+    g_nrun++;
+    g_nchunk++;
+}
+
+/* Append a plain record, fluentd only accepts maps so others are wrapped
+ * @retval false chunk full, nothing written */
+static bool put_record(const char *tag, uint32_t ntag, uint64_t time, const uint8_t *record, uint32_t nrecord)
+{
+    uint32_t mark;
+    if (!begin_entry(tag, ntag, time, &mark)) {
+        return false;
+    }
+    uMPReader rec(record, nrecord);
+    uint32_t npairs;
+    bool ok = rec.get_map(&npairs) || (g_out.start_map(1) && g_out.set_str("message", 7));
+    if (!ok || !g_out.set_raw((const char *)record, nrecord)) {
+        abort_entry(mark);
+        return false;
+    }
+    end_entry();
+    return true;
+}
+
+/* Expand a delta encoded batch into plain records, sending the chunk
+ * whenever the next record does not fit */
+static void put_delta(const char *tag, uint32_t ntag, const uint8_t *data, uint32_t size)
+{
+    FluentDeltaDecoder dec(data, size);
+    while (dec.has_more()) {
+        uint32_t mark;
+        uint32_t t;
+        bool begun = begin_entry(tag, ntag, 0, &mark);
+        if (begun && dec.next(&t, g_out)) {
+            if (t) {
+                uint8_t *p = g_out.get_buffer() + g_time_at;
+                p[0] = t >> 24;
+                p[1] = t >> 16;
+                p[2] = t >> 8;
+                p[3] = t;
+            }
+            end_entry();
+            continue;
+        }
+        if (begun) {
+            abort_entry(mark);
+        }
+        if (!dec.is_valid()) {
+            break;
+        }
+        if (mark == 0) {
+            fprintf(stderr, "delta record does not fit a chunk, rest of the batch dropped\n");
+            return;
+        }
+        // chunk full, the decoder hands out the same record again
+        send_chunk();
+    }
+    if (!dec.is_valid()) {
+        fprintf(stderr, "malformed delta batch, rest of it dropped\n");
+    }
+}
+
+/* Forward the [tag, time, record] messages of a frame payload */
+static void forward(const uint8_t *data, uint32_t size)
+{
+    uMPReader rd(data, size);
+    g_now = (uint32_t)time(NULL);
+    while (rd.get_remaining() > 0) {
+        const char *tag;
+        uint32_t ntag;
+        uint64_t t;
+        const uint8_t *record;
+        uint32_t nrecord;
+        uint32_t nelem;
+        if (!rd.get_array(&nelem) || nelem != 3 || !rd.get_str(&tag, &ntag)
+            || !rd.get_uint(&t) || !rd.skip(&record, &nrecord)) {
+            fprintf(stderr, "malformed frame payload, %u byte(s) dropped\n", rd.get_remaining());
+            break;
+        }
+
+        uMPReader rec(record, nrecord);
+        int8_t type;
+        const uint8_t *ext;
+        uint32_t next;
+        if (rec.get_ext(&type, &ext, &next) && type == FLUENT_DELTA_EXT_TYPE) {
+            put_delta(tag, ntag, ext, next);
+            continue;
+        }
+        if (put_record(tag, ntag, t, record, nrecord)) {
+            continue;
+        }
+        // chunk full, a record from a frame always fits an empty one
+        send_chunk();
+        if (!put_record(tag, ntag, t, record, nrecord)) {
+            fprintf(stderr, "record of %u bytes does not fit a chunk, dropped\n", nrecord);
+        }
+    }
+    // the runs point into the frame, which is overwritten by the next one
+    send_chunk();
+}
+
+int main(int argc, char **argv)
+{
+    long baud = 115200;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b') {
+            baud = strtol(optarg, NULL, 10);
+        } else {
+            argc = 0;
+        }
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, "usage: %s [-b baud] <tty> <host> [port]\n", argv[0]);
+        return 1;
+    }
+    g_host = argv[optind + 1];
+    if (argc - optind > 2) {
+        g_port = argv[optind + 2];
+    }
+
+    int tty = open_tty(argv[optind], baud);
+    if (tty < 0) {
+        return 1;
+    }
+
+    static uint8_t frame[MAX_FRAME + 4];
+    FluentFrameDecoder dec(frame, sizeof(frame));
+    bool have_seq = false;
+    uint16_t expect = 0;
+    uint32_t errors = 0;
+
+    for (;;) {
+        uint8_t rx[512];
+        ssize_t len = read(tty, rx, sizeof(rx));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            return 1;
+        }
+        if (len == 0) {
+            // pty peer closed, wait for it to come back
+            usleep(100000);
+            continue;
+        }
+
+        const uint8_t *p = rx;
+        while (len > 0) {
+            bool done;
+            uint32_t used = dec.feed(p, len, &done);
+            p += used;
+            len -= used;
+            if (dec.get_errors() != errors) {
+                fprintf(stderr, "%u bad frame(s)\n", dec.get_errors() - errors);
+                errors = dec.get_errors();
+            }
+            if (!done) {
+                continue;
+            }
+            // sequence restarts at 0 when the device reboots
+            if (have_seq && dec.get_seq() != expect && dec.get_seq() != 0) {
+                fprintf(stderr, "%u frame(s) lost\n", (uint16_t)(dec.get_seq() - expect));
+            }
+            have_seq = true;
+            expect = dec.get_seq() + 1;
+            forward(dec.get_payload(), dec.get_size());
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+# relay-upstream-close - fluent-relay survives fluentd closing mid-stream
+#
+# A fake fluentd closes its end of the first upstream connection after
+# a few kilobytes and then resets it while fluent-relay-bench keeps
+# sending, so the relay writes into a closed connection. The relay has to
+# stay up, reconnect and deliver to the second connection.
+#
+#   usage: tools/test/relay-upstream-close.sh [dir with fluent-relay and fluent-relay-bench]
+#
+# Needs python3 for the fake fluentd.
+
+BIN=${1:-.}
+UPSTREAM=${UPSTREAM_PORT:-24931}
+LISTEN=${LISTEN_PORT:-24932}
+TMP=$(mktemp -d)
+trap 'kill $RELAY $FAKE 2>/dev/null; rm -rf $TMP' EXIT
+
+python3 - $UPSTREAM > $TMP/fake.out <<'PY' &
+import socket, struct, sys
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+s.bind(("127.0.0.1", int(sys.argv[1])))
+s.listen(4)
+s.settimeout(6)
+for n in range(2):
+    try:
+        c, _ = s.accept()
+    except socket.timeout:
+        break
+    c.settimeout(2 if n > 0 else 0.5)
+    closing = False
+    got = 0
+    while True:
+        if n == 0 and got >= 4096 and not closing:
+            # close our end mid-stream, the relay keeps writing into it
+            c.shutdown(socket.SHUT_WR)
+            closing = True
+        try:
+            d = c.recv(65536)
+        except socket.timeout:
+            break
+        if not d or (closing and got >= 65536):
+            break
+        got += len(d)
+    if n == 0:
+        # then drop the connection with data still arriving
+        c.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+    c.close()
+    print("connection", n, got, flush=True)
+PY
+FAKE=$!
+sleep 0.5
+
+$BIN/fluent-relay -l $LISTEN -w 1 -c 4096 -f 10 -s 0 127.0.0.1 $UPSTREAM 2> $TMP/relay.err &
+RELAY=$!
+sleep 0.5
+$BIN/fluent-relay-bench -c 4 -d 3 127.0.0.1 $LISTEN > /dev/null 2>&1
+sleep 1
+
+if ! kill -0 $RELAY 2>/dev/null; then
+    wait $RELAY
+    echo "FAIL: fluent-relay exited with status $? when the upstream closed"
+    exit 1
+fi
+wait $FAKE
+if ! grep -q "^connection 1 [1-9]" $TMP/fake.out; then
+    echo "FAIL: nothing delivered after the reconnect"
+    cat $TMP/fake.out $TMP/relay.err
+    exit 1
+fi
+echo "PASS"
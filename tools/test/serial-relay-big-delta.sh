@@ -0,0 +1,129 @@
+#!/bin/sh
+# serial-relay-big-delta - a delta batch larger than one chunk is expanded in full
+#
+# Sends one frame over a pty: a delta batch of 5000 records with long
+# keys, which expands to more than a megabyte, followed by a plain
+# record. The relay has to send the expansion over several chunks and
+# deliver all 5001 records to a fake fluentd. Then a batch with a
+# corrupt tail must be reported as malformed and the records before the
+# corruption still delivered.
+#
+#   usage: tools/test/serial-relay-big-delta.sh [dir with fluent-serial-relay]
+#
+# Needs python3 for the fake device and the fake fluentd.
+
+BIN=${1:-.}
+UPSTREAM=${UPSTREAM_PORT:-24933}
+TMP=$(mktemp -d)
+trap 'kill $FAKE 2>/dev/null; rm -rf $TMP' EXIT
+
+run() {
+    python3 - $UPSTREAM > $TMP/fake.out <<'PY' &
+import socket, struct, sys
+
+def obj(b, i):
+    t = b[i]
+    if t <= 0x7f or t >= 0xe0 or t in (0xc0, 0xc2, 0xc3):
+        return i + 1
+    if 0xa0 <= t <= 0xbf:
+        return i + 1 + (t & 0x1f)
+    if 0x90 <= t <= 0x9f or 0x80 <= t <= 0x8f:
+        n = (t & 0x0f) * (2 if t < 0x90 else 1)
+        i += 1
+    elif t in (0xdc, 0xdd, 0xde, 0xdf):
+        w = 2 if t in (0xdc, 0xde) else 4
+        n = int.from_bytes(b[i + 1:i + 1 + w], "big") * (2 if t >= 0xde else 1)
+        i += 1 + w
+    elif t in (0xcc, 0xcd, 0xce, 0xcf, 0xd0, 0xd1, 0xd2, 0xd3):
+        return i + 1 + (1 << (t & 3))
+    elif t in (0xd9, 0xda, 0xdb):
+        w = 1 << (t - 0xd9)
+        return i + 1 + w + int.from_bytes(b[i + 1:i + 1 + w], "big")
+    else:
+        raise ValueError("type 0x%02x" % t)
+    for _ in range(n):
+        i = obj(b, i)
+    return i
+
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(("127.0.0.1", int(sys.argv[1])))
+s.listen(4)
+s.settimeout(4)
+data = b""
+while True:
+    try:
+        c, _ = s.accept()
+    except socket.timeout:
+        break
+    c.settimeout(1)
+    while True:
+        try:
+            d = c.recv(65536)
+        except socket.timeout:
+            break
+        if not d:
+            break
+        data += d
+    c.close()
+# [tag, [[time, record], ...]]: count the entries of each chunk
+records = 0
+i = 0
+while i < len(data):
+    start = i
+    assert data[i] == 0x92
+    i = obj(data, i + 1)
+    t = data[i]
+    records += (t & 0x0f) if t < 0xa0 else int.from_bytes(data[i + 1:i + 5 if t == 0xdd else i + 3], "big")
+    i = obj(data, start)
+print(records)
+PY
+    FAKE=$!
+    sleep 0.5
+    python3 - $BIN/fluent-serial-relay $UPSTREAM $1 2>$TMP/relay.err <<'PY'
+import os, pty, struct, subprocess, sys, time, tty
+
+def crc16(d, crc=0xffff):
+    for b in d:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xffff if crc & 0x8000 else (crc << 1) & 0xffff
+    return crc
+
+keys = [("key_%02d_with_a_rather_long_name" % i).encode() for i in range(8)]
+body = bytes([0x98]) + b"".join(bytes([0xa0 | len(k)]) + k for k in keys) + b"\xce" + struct.pack(">I", 1700000000)
+body += (bytes([1]) + bytes([1] * len(keys))) * 5000
+if sys.argv[3] == "corrupt":
+    body += b"\xc1"
+ext = b"\xc9" + struct.pack(">I", len(body)) + bytes([16]) + body
+payload = b"\x93\xa1d\x00" + ext + b"\x93\xa5plain\x05\x81\xa1k\x01"
+frame = struct.pack(">H", 1) + payload
+frame += struct.pack(">H", crc16(frame))
+slip = b"\xc0" + frame.replace(b"\xdb", b"\xdb\xdd").replace(b"\xc0", b"\xdb\xdc") + b"\xc0"
+
+m, s = pty.openpty()
+tty.setraw(s)
+relay = subprocess.Popen([sys.argv[1], os.ttyname(s), "127.0.0.1", sys.argv[2]])
+time.sleep(0.5)
+os.write(m, slip)
+time.sleep(1.5)
+relay.terminate()
+relay.wait()
+PY
+    wait $FAKE
+}
+
+run ok
+if [ "$(cat $TMP/fake.out)" != "5001" ] || [ -s $TMP/relay.err ]; then
+    echo "FAIL: expected 5001 records, got $(cat $TMP/fake.out)"
+    cat $TMP/relay.err
+    exit 1
+fi
+
+run corrupt
+if [ "$(cat $TMP/fake.out)" != "5001" ] || ! grep -q "malformed delta batch" $TMP/relay.err; then
+    echo "FAIL: corrupt batch: got $(cat $TMP/fake.out) records"
+    cat $TMP/relay.err
+    exit 1
+fi
+echo PASS
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# slow-fluentd - fluentd stand-in that drains each connection slowly
+#
+# Reads at most 16 KiB per connection every DELAY seconds (default 0.05)
+# with small socket buffers, so every connection is limited to about one
+# window per round trip. Used by the striping benchmark in
+# TESTS/fluentlogger/striping. Prints the bytes received per second.
+#
+#   usage: slow-fluentd.py [port] [delay]
+
+import socket
+import sys
+import threading
+import time
+
+port = int(sys.argv[1]) if len(sys.argv) > 1 else 24224
+delay = float(sys.argv[2]) if len(sys.argv) > 2 else 0.05
+total = [0]
+lock = threading.Lock()
+
+
+def serve(conn):
+    while True:
+        data = conn.recv(16384)
+        if not data:
+            break
+        with lock:
+            total[0] += len(data)
+        time.sleep(delay)
+    conn.close()
+
+
+def report():
+    last = 0
+    while True:
+        time.sleep(1)
+        with lock:
+            now = total[0]
+        if now != last:
+            print("%d bytes/s" % (now - last), flush=True)
+        last = now
+
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 16384)
+srv.bind(("0.0.0.0", port))
+srv.listen(16)
+threading.Thread(target=report, daemon=True).start()
+while True:
+    conn, _ = srv.accept()
+    conn.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 16384)
+    threading.Thread(target=serve, args=(conn,), daemon=True).start()
@@ -0,0 +1,98 @@
+/* ump-compact-bench - size and cost of uMP numeric compaction
+ * Copyright (c) 2014 Yuuichi Akagawa
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Encodes the same telemetry records with every compaction mode and
+ * prints the bytes per record and the encode time per record. The
+ * records use the wide types application code tends to keep values in
+ * (uint64_t counters, double readings).
+ *
+ *   usage: ump-compact-bench [-n records]
+ */
+
+#include "uMP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool encode(uMP &mp, uint32_t i)
+{
+    bool ok = mp.start_map(7);
+    ok = ok && mp.set_str("ts_ms") && mp.set_u64(1700000000000ULL + (uint64_t)i * 100);
+    ok = ok && mp.set_str("count") && mp.set_u64(i % 1000);
+    ok = ok && mp.set_str("errors") && mp.set_u32(i % 97 == 0);
+    ok = ok && mp.set_str("rssi") && mp.set_s64(-60 - (int64_t)(i % 20));
+    ok = ok && mp.set_str("temp") && mp.set_double(20.0 + (i % 16) * 0.25);    // exact in float
+    ok = ok && mp.set_str("humidity") && mp.set_double((double)(40 + i % 10));  // integral
+    ok = ok && mp.set_str("voltage") && mp.set_double(3.3 + (i % 7) * 0.01);   // needs double
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': n = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n records]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    static const struct {
+        const char *name;
+        uint8_t    mode;
+    } modes[] = {
+        { "none",             uMP::COMPACT_NONE },
+        { "int",              uMP::COMPACT_INT },
+        { "int+float",        uMP::COMPACT_INT | uMP::COMPACT_FLOAT },
+        { "lossless",         uMP::COMPACT_LOSSLESS },
+        { "lossless+lossy",   uMP::COMPACT_LOSSLESS | uMP::COMPACT_LOSSY_FLOAT },
+    };
+
+    uMP mp(256);
+    double base = 0;
+    printf("%-16s %10s %8s %10s\n", "mode", "bytes/rec", "saved", "ns/rec");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        mp.set_compact(modes[m].mode);
+        uint64_t bytes = 0;
+        double start = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            mp.init();
+            if (!encode(mp, i)) {
+                fprintf(stderr, "record does not fit\n");
+                return 1;
+            }
+            bytes += mp.get_size();
+        }
+        double ns = (now_ns() - start) / n;
+        double per = (double)bytes / n;
+        if (m == 0) {
+            base = per;
+        }
+        printf("%-16s %10.1f %7.1f%% %10.1f\n", modes[m].name, per, 100.0 * (base - per) / base, ns);
+    }
+    return 0;
+}
@@ -15,22 +15,47 @@
  */
 
 #include "uMP.h"
+#include <math.h>
+#include <float.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 uMP::uMP() :
-_ptr(0), _nbuf(DEFAULT_BUFFSIZE)
+_ptr(0), _nbuf(DEFAULT_BUFFSIZE), _own(true), _compact(COMPACT_NONE)
 {
     _buf = new uint8_t[_nbuf]; 
 }
 
 uMP::uMP(uint32_t size) :
-_ptr(0), _nbuf(size)
+_ptr(0), _nbuf(size), _own(true), _compact(COMPACT_NONE)
 {
   _buf = new uint8_t[_nbuf]; 
 }
 
+uMP::uMP(uint8_t *buf, uint32_t size) :
+_buf(buf), _ptr(0), _nbuf(size), _own(false), _compact(COMPACT_NONE)
+{
+}
+
 uMP::~uMP()
 {
-    delete[] _buf;
+    if (_own) {
+        delete[] _buf;
+    }
+}
+
+void uMP::attach(uint8_t *buf, uint32_t size)
+{
+    if (_own) {
+        delete[] _buf;
+    }
+    _buf = buf;
+    _nbuf = size;
+    _ptr = 0;
+    _own = false;
 }
 
 /* MessagePack funcions (Subset) */
@@ -54,7 +79,12 @@ bool uMP::start_array(uint32_t size)
     if (size <= 0x0f) {
         return set_buffer((uint8_t)(TAG_FIXARRAY | size));
     }
-    return false;
+    if (size <= 0xffff) {
+        uint16_t n = to_be16((uint16_t)size);
+        return set_buffer((uint8_t)TAG_ARRAY16) && set_buffer((uint8_t*)&n, sizeof(uint16_t));
+    }
+    size = to_be32(size);
+    return set_buffer((uint8_t)TAG_ARRAY32) && set_buffer((uint8_t*)&size, sizeof(uint32_t));
 }
 
 bool uMP::start_map(uint32_t size)
@@ -62,33 +92,55 @@ bool uMP::start_map(uint32_t size)
     if (size <= 0x0f) {
         return set_buffer((uint8_t)(TAG_FIXMAP | size));
     }
-#if 0
     if (size <= 0xffff) {
-        return cmp_write_map16(ctx, size);
+        uint16_t n = to_be16((uint16_t)size);
+        return set_buffer((uint8_t)TAG_MAP16) && set_buffer((uint8_t*)&n, sizeof(uint16_t));
     }
-#endif
-    return false;
+    size = to_be32(size);
+    return set_buffer((uint8_t)TAG_MAP32) && set_buffer((uint8_t*)&size, sizeof(uint32_t));
 }
 
-bool uMP::set_uint(uint32_t u)
+bool uMP::set_uint(uint64_t u)
 {
     if (u <= 0x7f) {
         return set_buffer((uint8_t)u);
     }
     if (u <= 0xff) {
-        return set_u8((uint8_t)u);
+        return set_tagged(TAG_U8, u, 1);
     }
     if (u <= 0xffff) {
-        return set_u16((uint16_t)u);
+        return set_tagged(TAG_U16, u, 2);
     }
     if (u <= 0xffffffff) {
-        return set_u32(u);
+        return set_tagged(TAG_U32, u, 4);
+    }
+    return set_tagged(TAG_U64, u, 8);
+}
+
+bool uMP::set_tagged(uint8_t tag, uint64_t v, uint32_t size)
+{
+    uint8_t *p = reserve(size + 1);
+    if (p == NULL) {
+        return false;
+    }
+    *p++ = tag;
+    while (size--) {
+        p[size] = (uint8_t)v;
+        v >>= 8;
     }
-    return false;
+    return true;
+}
+
+void uMP::set_compact(uint8_t mode)
+{
+    _compact = mode;
 }
 
 bool uMP::set_u8(uint8_t u)
 {
+    if (_compact & COMPACT_INT) {
+        return set_uint(u);
+    }
     if (!set_buffer((uint8_t)TAG_U8)) {
         return false;
     }
@@ -97,6 +149,9 @@ bool uMP::set_u8(uint8_t u)
 
 bool uMP::set_u16(uint16_t u)
 {
+    if (_compact & COMPACT_INT) {
+        return set_uint(u);
+    }
     if (!set_buffer((uint8_t)TAG_U16)) {
         return false;
     }
@@ -107,6 +162,9 @@ bool uMP::set_u16(uint16_t u)
 
 bool uMP::set_u32(uint32_t u)
 {
+    if (_compact & COMPACT_INT) {
+        return set_uint(u);
+    }
     if (!set_buffer((uint8_t)TAG_U32)) {
         return false;
     }
@@ -117,6 +175,9 @@ bool uMP::set_u32(uint32_t u)
 
 bool uMP::set_u64(uint64_t u)
 {
+    if (_compact & COMPACT_INT) {
+        return set_uint(u);
+    }
     if (!set_buffer((uint8_t)TAG_U64)) {
         return false;
     }
@@ -125,28 +186,31 @@ bool uMP::set_u64(uint64_t u)
     return set_buffer((uint8_t*)&u, sizeof(uint64_t));
 }
 
-bool uMP::set_sint(int32_t i)
+bool uMP::set_sint(int64_t i)
 {
     if (i >=0) {
-        return set_uint((uint32_t)i);
+        return set_uint((uint64_t)i);
     }
     if (i >= -32) {
         return set_buffer((uint8_t)i);
     }
     if (i >= -128) {
-        return set_s8(i);
+        return set_tagged(TAG_S8, (uint64_t)i, 1);
     }
     if (i >= -32768) {
-        return set_s16(i);
+        return set_tagged(TAG_S16, (uint64_t)i, 2);
     }
-    if (i >= -2147483648) {
-        return set_s32(i);
+    if (i >= INT32_MIN) {
+        return set_tagged(TAG_S32, (uint64_t)i, 4);
     }
-    return false;
+    return set_tagged(TAG_S64, (uint64_t)i, 8);
 }
 
 bool uMP::set_s8(int8_t i)
 {
+    if (_compact & COMPACT_INT) {
+        return set_sint(i);
+    }
     if (!set_buffer((uint8_t)TAG_S8)) {
         return false;
     }
@@ -155,6 +219,9 @@ bool uMP::set_s8(int8_t i)
 
 bool uMP::set_s16(int16_t i)
 {
+    if (_compact & COMPACT_INT) {
+        return set_sint(i);
+    }
     if (!set_buffer((uint8_t)TAG_S16)) {
         return false;
     }
@@ -165,6 +232,9 @@ bool uMP::set_s16(int16_t i)
 
 bool uMP::set_s32(int32_t i)
 {
+    if (_compact & COMPACT_INT) {
+        return set_sint(i);
+    }
     if (!set_buffer((uint8_t)TAG_S32)) {
         return false;
     }
@@ -175,6 +245,9 @@ bool uMP::set_s32(int32_t i)
 
 bool uMP::set_s64(int64_t i)
 {
+    if (_compact & COMPACT_INT) {
+        return set_sint(i);
+    }
     if (!set_buffer((uint8_t)TAG_S64)) {
         return false;
     }
@@ -185,13 +258,25 @@ bool uMP::set_s64(int64_t i)
 
 bool uMP::set_str(const char *data, uint32_t size)
 {
+    uint32_t mark = _ptr;
+    bool ok;
     if (size <= 0x1f) {
-        return set_fixstr(data, size);
+        ok = set_fixstr(data, size);
+    } else if (size <= 0xff) {
+        ok = set_str8(data, size);
+    } else if (size <= 0xffff) {
+        uint16_t n = to_be16((uint16_t)size);
+        ok = set_buffer((uint8_t)TAG_STR16) && set_buffer((uint8_t*)&n, sizeof(uint16_t))
+             && set_buffer((const uint8_t*)data, size);
+    } else {
+        uint32_t n = to_be32(size);
+        ok = set_buffer((uint8_t)TAG_STR32) && set_buffer((uint8_t*)&n, sizeof(uint32_t))
+             && set_buffer((const uint8_t*)data, size);
     }
-    if (size <= 0xff) {
-        return set_str8(data, size);
+    if (!ok) {
+        _ptr = mark;
     }
-    return false;
+    return ok;
 }
 
 bool uMP::set_str(const std::string& str)
@@ -199,6 +284,58 @@ bool uMP::set_str(const std::string& str)
     return set_str(str.c_str(), (uint32_t)str.size());
 }
 
+bool uMP::set_str(const char *str)
+{
+    return set_str(str, (uint32_t)strlen(str));
+}
+
+bool uMP::set_strf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    bool ret = set_vstrf(fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+bool uMP::set_vstrf(const char *fmt, va_list ap)
+{
+    // format behind a fixstr header, then patch the header; longer
+    // strings are moved up over the NUL to make room for the length
+    if (_ptr >= _nbuf) {
+        return false;
+    }
+    uint32_t avail = _nbuf - _ptr - 1;
+    if (avail > 0x10000) {
+        avail = 0x10000;  // 65535 bytes + terminating NUL
+    }
+    char *p = (char*)(_buf + _ptr + 1);
+    int n = vsnprintf(p, avail, fmt, ap);
+    if (n < 0 || (uint32_t)n >= avail) {
+        return false;
+    }
+
+    if (n <= 0x1f) {
+        *(_buf+_ptr) = (uint8_t)(TAG_FIXSTR | n);
+        _ptr += 1 + n;
+    } else if (n <= 0xff) {
+        memmove(p + 1, p, n);
+        *(_buf+_ptr)   = (uint8_t)TAG_STR8;
+        *(_buf+_ptr+1) = (uint8_t)n;
+        _ptr += 2 + n;
+    } else {
+        if ( (_ptr+3+n) > _nbuf) {
+            return false;
+        }
+        memmove(p + 2, p, n);
+        *(_buf+_ptr)   = (uint8_t)TAG_STR16;
+        *(_buf+_ptr+1) = (uint8_t)(n >> 8);
+        *(_buf+_ptr+2) = (uint8_t)n;
+        _ptr += 3 + n;
+    }
+    return true;
+}
+
 bool uMP::set_fixstr(const char *data, uint8_t size)
 {
     if (size > 0x1f) {
@@ -230,7 +367,259 @@ bool uMP::set_str8(const char *data, uint8_t size)
     return true;
 }
 
-bool uMP::set_raw(const char *data, uint8_t size)
+bool uMP::start_bin(uint32_t size)
+{
+    if (size <= 0xff) {
+        return set_buffer((uint8_t)TAG_BIN8) && set_buffer((uint8_t)size);
+    }
+    if (size <= 0xffff) {
+        uint16_t n = to_be16((uint16_t)size);
+        return set_buffer((uint8_t)TAG_BIN16) && set_buffer((uint8_t*)&n, sizeof(uint16_t));
+    }
+    size = to_be32(size);
+    return set_buffer((uint8_t)TAG_BIN32) && set_buffer((uint8_t*)&size, sizeof(uint32_t));
+}
+
+bool uMP::set_bin(const void *data, uint32_t size)
+{
+    uint32_t mark = _ptr;
+    if (!start_bin(size) || !set_buffer((const uint8_t*)data, size)) {
+        _ptr = mark;
+        return false;
+    }
+    return true;
+}
+
+bool uMP::start_ext(int8_t type, uint32_t size)
+{
+    uint32_t mark = _ptr;
+    bool ok;
+    switch (size) {
+        case 1:  ok = set_buffer((uint8_t)TAG_FIXEXT1);  break;
+        case 2:  ok = set_buffer((uint8_t)TAG_FIXEXT2);  break;
+        case 4:  ok = set_buffer((uint8_t)TAG_FIXEXT4);  break;
+        case 8:  ok = set_buffer((uint8_t)TAG_FIXEXT8);  break;
+        case 16: ok = set_buffer((uint8_t)TAG_FIXEXT16); break;
+        default:
+            if (size <= 0xff) {
+                ok = set_buffer((uint8_t)TAG_EXT8) && set_buffer((uint8_t)size);
+            } else if (size <= 0xffff) {
+                uint16_t n = to_be16((uint16_t)size);
+                ok = set_buffer((uint8_t)TAG_EXT16) && set_buffer((uint8_t*)&n, sizeof(uint16_t));
+            } else {
+                uint32_t n = to_be32(size);
+                ok = set_buffer((uint8_t)TAG_EXT32) && set_buffer((uint8_t*)&n, sizeof(uint32_t));
+            }
+            break;
+    }
+    if (!ok || !set_buffer((uint8_t)type)) {
+        _ptr = mark;
+        return false;
+    }
+    return true;
+}
+
+bool uMP::set_ext(int8_t type, const void *data, uint32_t size)
+{
+    uint32_t mark = _ptr;
+    if (!start_ext(type, size) || !set_buffer((const uint8_t*)data, size)) {
+        _ptr = mark;
+        return false;
+    }
+    return true;
+}
+
+/* Bulk conversion loops, no per-element checks. Compilers do not turn
+ * the REV loops into vector code, so on targets with a 128 bit byte
+ * shuffle (NEON, SSSE3) whole 16 byte blocks are swapped explicitly:
+ * 8 int16 or 4 float/uint32 per load, shuffle and store. The rest, and
+ * everything on Cortex-M, takes one REV per element; memcpy keeps
+ * unaligned access legal (the output is packed). */
+#if defined(__ARM_NEON)
+#define UMP_SWAP_BLOCK 16
+
+static inline void swap16_block(uint8_t *dst, const uint8_t *src)
+{
+    vst1q_u8(dst, vrev16q_u8(vld1q_u8(src)));
+}
+
+static inline void swap32_block(uint8_t *dst, const uint8_t *src)
+{
+    vst1q_u8(dst, vrev32q_u8(vld1q_u8(src)));
+}
+#elif defined(__SSSE3__)
+#define UMP_SWAP_BLOCK 16
+
+static inline void swap16_block(uint8_t *dst, const uint8_t *src)
+{
+    const __m128i order = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, order));
+}
+
+static inline void swap32_block(uint8_t *dst, const uint8_t *src)
+{
+    const __m128i order = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, order));
+}
+#endif
+
+static void store_be16(uint8_t *dst, const void *src, uint32_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0;
+#ifdef UMP_SWAP_BLOCK
+    for (; i + UMP_SWAP_BLOCK / 2 <= n; i += UMP_SWAP_BLOCK / 2) {
+        swap16_block(dst + 2 * i, s + 2 * i);
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t v;
+        memcpy(&v, s + 2 * i, 2);
+        v = (uint16_t)__REV16(v);
+        memcpy(dst + 2 * i, &v, 2);
+    }
+}
+
+static void store_be32(uint8_t *dst, const void *src, uint32_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0;
+#ifdef UMP_SWAP_BLOCK
+    for (; i + UMP_SWAP_BLOCK / 4 <= n; i += UMP_SWAP_BLOCK / 4) {
+        swap32_block(dst + 4 * i, s + 4 * i);
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t v;
+        memcpy(&v, s + 4 * i, 4);
+        v = __REV(v);
+        memcpy(dst + 4 * i, &v, 4);
+    }
+}
+
+/* The tagged forms swap a block into a temporary and copy it out
+ * behind the tags */
+static void store_tagged_be16(uint8_t *dst, uint8_t tag, const void *src, uint32_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0;
+#ifdef UMP_SWAP_BLOCK
+    uint8_t block[UMP_SWAP_BLOCK];
+    for (; i + UMP_SWAP_BLOCK / 2 <= n; i += UMP_SWAP_BLOCK / 2) {
+        swap16_block(block, s + 2 * i);
+        for (uint32_t k = 0; k < UMP_SWAP_BLOCK / 2; k++) {
+            dst[3 * (i + k)] = tag;
+            memcpy(dst + 3 * (i + k) + 1, block + 2 * k, 2);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t v;
+        memcpy(&v, s + 2 * i, 2);
+        v = (uint16_t)__REV16(v);
+        dst[3 * i] = tag;
+        memcpy(dst + 3 * i + 1, &v, 2);
+    }
+}
+
+static void store_tagged_be32(uint8_t *dst, uint8_t tag, const void *src, uint32_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0;
+#ifdef UMP_SWAP_BLOCK
+    uint8_t block[UMP_SWAP_BLOCK];
+    for (; i + UMP_SWAP_BLOCK / 4 <= n; i += UMP_SWAP_BLOCK / 4) {
+        swap32_block(block, s + 4 * i);
+        for (uint32_t k = 0; k < UMP_SWAP_BLOCK / 4; k++) {
+            dst[5 * (i + k)] = tag;
+            memcpy(dst + 5 * (i + k) + 1, block + 4 * k, 4);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t v;
+        memcpy(&v, s + 4 * i, 4);
+        v = __REV(v);
+        dst[5 * i] = tag;
+        memcpy(dst + 5 * i + 1, &v, 4);
+    }
+}
+
+bool uMP::set_float_array(const float *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if (!start_array(n) || (dst = reserve((uint64_t)n * 5)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_tagged_be32(dst, TAG_FLOAT32, v, n);
+    return true;
+}
+
+bool uMP::set_s16_array(const int16_t *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if (!start_array(n) || (dst = reserve((uint64_t)n * 3)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_tagged_be16(dst, TAG_S16, v, n);
+    return true;
+}
+
+bool uMP::set_u32_array(const uint32_t *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if (!start_array(n) || (dst = reserve((uint64_t)n * 5)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_tagged_be32(dst, TAG_U32, v, n);
+    return true;
+}
+
+bool uMP::set_float_bin(const float *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if ((uint64_t)n * 4 > 0xffffffff || !start_bin(n * 4) || (dst = reserve((uint64_t)n * 4)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_be32(dst, v, n);
+    return true;
+}
+
+bool uMP::set_s16_bin(const int16_t *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if ((uint64_t)n * 2 > 0xffffffff || !start_bin(n * 2) || (dst = reserve((uint64_t)n * 2)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_be16(dst, v, n);
+    return true;
+}
+
+bool uMP::set_u32_bin(const uint32_t *v, uint32_t n)
+{
+    uint32_t mark = _ptr;
+    uint8_t *dst;
+    if ((uint64_t)n * 4 > 0xffffffff || !start_bin(n * 4) || (dst = reserve((uint64_t)n * 4)) == NULL) {
+        _ptr = mark;
+        return false;
+    }
+    store_be32(dst, v, n);
+    return true;
+}
+
+bool uMP::set_raw(const char *data, uint32_t size)
 {
     if (!set_buffer((uint8_t*)data, size)) {
         return false;
@@ -240,6 +629,10 @@ bool uMP::set_raw(const char *data, uint8_t size)
 
 bool uMP::set_float(float f)
 {
+    // float has 24 bits of mantissa, every integral value below 2^24 is exact
+    if ((_compact & COMPACT_INTEGRAL) && f > -16777216.0f && f < 16777216.0f && f == (float)(int32_t)f && !(f == 0.0f && signbit(f))) {
+        return set_sint((int32_t)f);
+    }
     if (!set_buffer((uint8_t)TAG_FLOAT32)) {
         return false;
     }
@@ -252,6 +645,17 @@ bool uMP::set_float(float f)
 
 bool uMP::set_double(double d)
 {
+    if ((_compact & COMPACT_INTEGRAL) && d > -9007199254740992.0 && d < 9007199254740992.0 && d == (double)(int64_t)d && !(d == 0.0 && signbit(d))) {
+        return set_sint((int64_t)d);
+    }
+    // converting a finite value outside the float range is undefined,
+    // NaN and infinities convert exactly (NaN never compares equal)
+    if ((_compact & (COMPACT_FLOAT | COMPACT_LOSSY_FLOAT)) && (d != d || isinf(d) || fabs(d) <= FLT_MAX)) {
+        float f = (float)d;
+        if ((_compact & COMPACT_LOSSY_FLOAT) || (double)f == d || d != d) {
+            return set_float(f);
+        }
+    }
     if (!set_buffer((uint8_t)TAG_FLOAT64)) {
         return false;
     }
@@ -279,13 +683,22 @@ bool uMP::set_buffer(const uint8_t *c, size_t size)
     if ( (_ptr+size) > _nbuf) {
         return false;
     }
-    while (size--) {
-        *(_buf+_ptr) = *c++;
-        _ptr++;
-    }
+    memcpy(_buf + _ptr, c, size);
+    _ptr += size;
     return true;
 }
 
+uint8_t *uMP::reserve(uint64_t size)
+{
+    //buffer overflow?
+    if (size > _nbuf - _ptr) {
+        return NULL;
+    }
+    uint8_t *p = _buf + _ptr;
+    _ptr += (uint32_t)size;
+    return p;
+}
+
 //ByteOrder
 template<typename T> T uMP::to_be16(T t)
 {
@@ -313,6 +726,13 @@ template<typename T> T uMP::to_be64(T t)
 }
 
 // map functions
+bool uMP::map(const std::string& k, bool v)
+{
+    if( set_str(k) == false )
+        return false;
+    return v ? set_true() : set_false();
+}
+
 bool uMP::map(const std::string& k, uint8_t v)
 {
     if( set_str(k) == false )
@@ -382,3 +802,352 @@ bool uMP::map(const std::string& k, const std::string& v)
         return false;
     return set_str(v);
 }
+
+bool uMP::map(const char *k, bool v)
+{
+    if( set_str(k) == false )
+        return false;
+    return v ? set_true() : set_false();
+}
+
+bool uMP::map(const char *k, uint8_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_u8(v);
+}
+
+bool uMP::map(const char *k, uint16_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_u16(v);
+}
+
+bool uMP::map(const char *k, uint32_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_uint(v);
+}
+
+bool uMP::map(const char *k, int8_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_s8(v);
+}
+
+bool uMP::map(const char *k, int16_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_s16(v);
+}
+
+bool uMP::map(const char *k, int32_t v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_sint(v);
+}
+
+bool uMP::map(const char *k, float v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_float(v);
+}
+
+bool uMP::map(const char *k, double v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_double(v);
+}
+
+bool uMP::map(const char *k, const char * v)
+{
+    if( set_str(k) == false )
+        return false;
+    return set_str(v);
+}
+
+/* Decoder */
+bool uMPReader::get_be(uint32_t size, uint64_t *v)
+{
+    if ( (_ptr+size) > _nbuf) {
+        return false;
+    }
+    uint64_t x = 0;
+    while (size--) {
+        x = (x << 8) | *(_buf+_ptr);
+        _ptr++;
+    }
+    *v = x;
+    return true;
+}
+
+bool uMPReader::get_header(uint8_t *tag, uint32_t *len, int8_t *type)
+{
+    uint64_t v = 0;
+    uint32_t start = _ptr;
+
+    if (_ptr >= _nbuf) {
+        return false;
+    }
+    uint8_t c = *(_buf+_ptr);
+    _ptr++;
+    *tag = c;
+    *len = 0;
+    *type = 0;
+
+    if (c <= 0x7f || c >= uMP::TAG_NEGATIVE_FIXNUM) {
+        return true;
+    }
+    if ((c & 0xf0) == uMP::TAG_FIXMAP) {
+        *tag = uMP::TAG_FIXMAP;
+        *len = c & 0x0f;
+        return true;
+    }
+    if ((c & 0xf0) == uMP::TAG_FIXARRAY) {
+        *tag = uMP::TAG_FIXARRAY;
+        *len = c & 0x0f;
+        return true;
+    }
+    if ((c & 0xe0) == uMP::TAG_FIXSTR) {
+        *tag = uMP::TAG_FIXSTR;
+        *len = c & 0x1f;
+        return true;
+    }
+
+    bool ok = true;
+    switch (c) {
+        case uMP::TAG_NIL:
+        case uMP::TAG_FALSE:
+        case uMP::TAG_TRUE:
+            break;
+        case uMP::TAG_U8:  case uMP::TAG_S8:  *len = 1; break;
+        case uMP::TAG_U16: case uMP::TAG_S16: *len = 2; break;
+        case uMP::TAG_U32: case uMP::TAG_S32: case uMP::TAG_FLOAT32: *len = 4; break;
+        case uMP::TAG_U64: case uMP::TAG_S64: case uMP::TAG_FLOAT64: *len = 8; break;
+        case uMP::TAG_BIN8:  case uMP::TAG_STR8:
+            ok = get_be(1, &v); *len = v; break;
+        case uMP::TAG_BIN16: case uMP::TAG_STR16: case uMP::TAG_ARRAY16: case uMP::TAG_MAP16:
+            ok = get_be(2, &v); *len = v; break;
+        case uMP::TAG_BIN32: case uMP::TAG_STR32: case uMP::TAG_ARRAY32: case uMP::TAG_MAP32:
+            ok = get_be(4, &v); *len = v; break;
+        case uMP::TAG_FIXEXT1:  *len = 1;  ok = get_be(1, &v); *type = (int8_t)v; break;
+        case uMP::TAG_FIXEXT2:  *len = 2;  ok = get_be(1, &v); *type = (int8_t)v; break;
+        case uMP::TAG_FIXEXT4:  *len = 4;  ok = get_be(1, &v); *type = (int8_t)v; break;
+        case uMP::TAG_FIXEXT8:  *len = 8;  ok = get_be(1, &v); *type = (int8_t)v; break;
+        case uMP::TAG_FIXEXT16: *len = 16; ok = get_be(1, &v); *type = (int8_t)v; break;
+        case uMP::TAG_EXT8:
+        case uMP::TAG_EXT16:
+        case uMP::TAG_EXT32:
+            ok = get_be(c == uMP::TAG_EXT8 ? 1 : (c == uMP::TAG_EXT16 ? 2 : 4), &v);
+            *len = v;
+            ok = ok && get_be(1, &v);
+            *type = (int8_t)v;
+            break;
+        default:
+            ok = false; // 0xc1 is never used
+            break;
+    }
+    if (!ok) {
+        _ptr = start;
+    }
+    return ok;
+}
+
+bool uMPReader::skip(const uint8_t **data, uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint64_t pending = 1;
+    uint8_t tag;
+    uint32_t len;
+    int8_t type;
+
+    while (pending > 0) {
+        if (!get_header(&tag, &len, &type)) {
+            _ptr = start;
+            return false;
+        }
+        pending--;
+        if (tag == uMP::TAG_FIXARRAY || tag == uMP::TAG_ARRAY16 || tag == uMP::TAG_ARRAY32) {
+            pending += len;
+        } else if (tag == uMP::TAG_FIXMAP || tag == uMP::TAG_MAP16 || tag == uMP::TAG_MAP32) {
+            pending += 2 * (uint64_t)len;
+        } else {
+            // scalar payload, string, binary or extension data
+            if (len > _nbuf - _ptr) {
+                _ptr = start;
+                return false;
+            }
+            _ptr += len;
+        }
+        // every element takes at least a byte, reject hostile counts early
+        if (pending > _nbuf - _ptr) {
+            _ptr = start;
+            return false;
+        }
+    }
+    if (data) {
+        *data = _buf + start;
+    }
+    if (size) {
+        *size = _ptr - start;
+    }
+    return true;
+}
+
+bool uMPReader::get_array(uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint8_t tag;
+    int8_t type;
+    if (!get_header(&tag, size, &type)) {
+        return false;
+    }
+    if (tag != uMP::TAG_FIXARRAY && tag != uMP::TAG_ARRAY16 && tag != uMP::TAG_ARRAY32) {
+        _ptr = start;
+        return false;
+    }
+    return true;
+}
+
+bool uMPReader::get_map(uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint8_t tag;
+    int8_t type;
+    if (!get_header(&tag, size, &type)) {
+        return false;
+    }
+    if (tag != uMP::TAG_FIXMAP && tag != uMP::TAG_MAP16 && tag != uMP::TAG_MAP32) {
+        _ptr = start;
+        return false;
+    }
+    return true;
+}
+
+bool uMPReader::get_str(const char **data, uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint8_t tag;
+    int8_t type;
+    if (!get_header(&tag, size, &type)) {
+        return false;
+    }
+    if ((tag != uMP::TAG_FIXSTR && tag != uMP::TAG_STR8 && tag != uMP::TAG_STR16 && tag != uMP::TAG_STR32)
+        || *size > _nbuf - _ptr) {
+        _ptr = start;
+        return false;
+    }
+    *data = (const char *)(_buf + _ptr);
+    _ptr += *size;
+    return true;
+}
+
+bool uMPReader::get_bin(const uint8_t **data, uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint8_t tag;
+    int8_t type;
+    if (!get_header(&tag, size, &type)) {
+        return false;
+    }
+    if ((tag != uMP::TAG_BIN8 && tag != uMP::TAG_BIN16 && tag != uMP::TAG_BIN32)
+        || *size > _nbuf - _ptr) {
+        _ptr = start;
+        return false;
+    }
+    *data = _buf + _ptr;
+    _ptr += *size;
+    return true;
+}
+
+bool uMPReader::get_ext(int8_t *type, const uint8_t **data, uint32_t *size)
+{
+    uint32_t start = _ptr;
+    uint8_t tag;
+    if (!get_header(&tag, size, type)) {
+        return false;
+    }
+    if (tag < uMP::TAG_EXT8 || (tag > uMP::TAG_EXT32 && tag < uMP::TAG_FIXEXT1) || tag > uMP::TAG_FIXEXT16
+        || *size > _nbuf - _ptr) {
+        _ptr = start;
+        return false;
+    }
+    *data = _buf + _ptr;
+    _ptr += *size;
+    return true;
+}
+
+bool uMPReader::get_uint(uint64_t *u)
+{
+    int64_t i;
+    uint32_t start = _ptr;
+    if (_ptr < _nbuf && *(_buf+_ptr) == uMP::TAG_U64) {
+        _ptr++;
+        if (!get_be(8, u)) {
+            _ptr = start;
+            return false;
+        }
+        return true;
+    }
+    if (!get_sint(&i) || i < 0) {
+        _ptr = start;
+        return false;
+    }
+    *u = (uint64_t)i;
+    return true;
+}
+
+bool uMPReader::get_sint(int64_t *i)
+{
+    uint32_t start = _ptr;
+    uint64_t v = 0;
+
+    if (_ptr >= _nbuf) {
+        return false;
+    }
+    uint8_t c = *(_buf+_ptr);
+    _ptr++;
+    bool ok = true;
+    if (c <= 0x7f) {
+        *i = c;
+    } else if (c >= uMP::TAG_NEGATIVE_FIXNUM) {
+        *i = (int8_t)c;
+    } else {
+        switch (c) {
+            case uMP::TAG_U8:  ok = get_be(1, &v); *i = (int64_t)v; break;
+            case uMP::TAG_U16: ok = get_be(2, &v); *i = (int64_t)v; break;
+            case uMP::TAG_U32: ok = get_be(4, &v); *i = (int64_t)v; break;
+            case uMP::TAG_U64: ok = get_be(8, &v) && v <= (uint64_t)INT64_MAX; *i = (int64_t)v; break;
+            case uMP::TAG_S8:  ok = get_be(1, &v); *i = (int8_t)v; break;
+            case uMP::TAG_S16: ok = get_be(2, &v); *i = (int16_t)v; break;
+            case uMP::TAG_S32: ok = get_be(4, &v); *i = (int32_t)v; break;
+            case uMP::TAG_S64: ok = get_be(8, &v); *i = (int64_t)v; break;
+            default: ok = false; break;
+        }
+    }
+    if (!ok) {
+        _ptr = start;
+    }
+    return ok;
+}
+
+bool uMPReader::get_bool(bool *b)
+{
+    if (_ptr >= _nbuf) {
+        return false;
+    }
+    uint8_t c = *(_buf+_ptr);
+    if (c != uMP::TAG_TRUE && c != uMP::TAG_FALSE) {
+        return false;
+    }
+    *b = (c == uMP::TAG_TRUE);
+    _ptr++;
+    return true;
+}
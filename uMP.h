@@ -17,8 +17,17 @@
 #ifndef MBED_UMP_H
 #define MBED_UMP_H
 
+#if defined(__MBED__)
 #include "mbed.h"
+#else
+// host build (gateway tools), no CMSIS
+#define __REV(x)    __builtin_bswap32(x)
+#define __REV16(x)  __builtin_bswap16(x)
+#define MBED_PRINTF_METHOD(format_idx, first_param_idx) \
+    __attribute__ ((__format__(__printf__, format_idx + 1, first_param_idx == 0 ? 0 : first_param_idx + 1)))
+#endif
 #include <stdint.h>
+#include <stdarg.h>
 #include <string.h>
 #include <string>
 
@@ -27,6 +36,16 @@
  */
 class uMP {
 public:
+    /** Numeric compaction modes (see set_compact()) */
+    enum Compact {
+        COMPACT_NONE        = 0,    /**< encode as requested */
+        COMPACT_INT         = 1,    /**< fixed width integers in the smallest encoding */
+        COMPACT_FLOAT       = 2,    /**< doubles as float32 when exact */
+        COMPACT_INTEGRAL    = 4,    /**< integral floats and doubles as integers */
+        COMPACT_LOSSY_FLOAT = 8,    /**< doubles as float32 even when inexact */
+        COMPACT_LOSSLESS    = COMPACT_INT | COMPACT_FLOAT | COMPACT_INTEGRAL
+    };
+
     /** uMP
      */
     uMP();
@@ -35,18 +54,66 @@ public:
      * @param size buffer size
      */
     explicit uMP(uint32_t size);
+    /** uMP on caller supplied memory (no allocation)
+     *
+     * @param buf message buffer
+     * @param size buffer size
+     */
+    uMP(uint8_t *buf, uint32_t size);
     ~uMP();
 
+    /** Switch to caller supplied memory (frees an own buffer)
+     *
+     * @param buf message buffer
+     * @param size buffer size
+     */
+    void attach(uint8_t *buf, uint32_t size);
+
+    /** Select numeric compaction
+     *
+     * With compaction the set_xxx() functions of fixed width pick the
+     * smallest encoding that keeps the value (COMPACT_LOSSLESS). Decoders
+     * see the same number, but possibly with a narrower type, e.g. an
+     * integer for 21.0. COMPACT_LOSSY_FLOAT trades double precision for
+     * 4 bytes per value.
+     *
+     * @param mode COMPACT_xxx flags (default: COMPACT_NONE)
+     */
+    void set_compact(uint8_t mode);
+
+    /** Get numeric compaction
+     * @return COMPACT_xxx flags
+     */
+    inline uint8_t get_compact() const { return _compact; }
+
     /** Initialize buffer pointer
      */
     void init(){ _ptr = 0; }
 
+    /** Discard everything written after a previous get_size()
+     *
+     * @param size message size to go back to
+     */
+    void rewind(uint32_t size){ if (size < _ptr) { _ptr = size; } }
+
+    /** Continue after data already in the buffer (e.g. kept across a reset)
+     *
+     * @param size message size to continue from
+     */
+    void resume(uint32_t size){ if (size <= _nbuf) { _ptr = size; } }
+
     /** Get message size
      *
      * @return message size(bytes)
      */
     inline uint32_t get_size(){ return _ptr; }
 
+    /** Get message buffer length
+     *
+     * @return buffer length(bytes)
+     */
+    inline uint32_t get_capacity(){ return _nbuf; }
+
     /** Get message buffer pointer
      *
      * @return Pointer of message buffer
@@ -94,11 +161,11 @@ public:
      *
      * Auto route the optimal function.
      *
-     * @param u unsigned int value(max 32bit)
+     * @param u unsigned int value
      * @retval true Success
      * @retval false Failure
      */
-    bool set_uint(uint32_t u); //max 32bit
+    bool set_uint(uint64_t u);
 
     /** Set uint8 message
      *
@@ -136,11 +203,11 @@ public:
      *
      * Auto route the optimal function.
      *
-     * @param s signed int value(max 32bit)
+     * @param s signed int value
      * @retval true Success
      * @retval false Failure
      */
-    bool set_sint(int32_t i);  //max 32bit
+    bool set_sint(int64_t i);
 
     /** Set int8 message
      *
@@ -192,12 +259,12 @@ public:
 
     /** Set string message
      *
-     * Auto route the optimal function.
+     * Auto route the optimal function: fixstr, str8, str16 or str32.
      *
      * @param data Pointer of message string
-     * @param size Size of message string (max 255 bytes)
+     * @param size Size of message string
      * @retval true Success
-     * @retval false Failure
+     * @retval false Failure (buffer full, nothing is written)
      */
     bool set_str(const char *data, uint32_t size);
 
@@ -211,6 +278,37 @@ public:
      */
     bool set_str(const std::string& str);
 
+    /** Set null terminated string message
+     *
+     * @param str String
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool set_str(const char *str);
+
+    /** Set formatted string message
+     *
+     * Format printf-style arguments straight into the buffer and patch
+     * the string header afterwards, no intermediate copy is made.
+     * Results up to 65535 bytes are encoded (str16 above 255 bytes).
+     * vsnprintf() terminates its output, so a string below 32 bytes
+     * needs one free byte more than its encoding.
+     *
+     * @param fmt printf format string
+     * @retval true Success
+     * @retval false Failure (buffer full or result longer than 65535 bytes)
+     */
+    bool set_strf(const char *fmt, ...) MBED_PRINTF_METHOD(1, 2);
+
+    /** Set formatted string message (va_list version)
+     *
+     * @param fmt printf format string
+     * @param ap argument list
+     * @retval true Success
+     * @retval false Failure (buffer full or result longer than 65535 bytes)
+     */
+    bool set_vstrf(const char *fmt, va_list ap) MBED_PRINTF_METHOD(1, 0);
+
     /** Set string message (upto 31 bytes)
      *
      * @param data Pointer of message string
@@ -229,17 +327,123 @@ public:
      */
     bool set_str8(const char *data, uint8_t size);
 
+    /** Set binary message
+     *
+     * @param data Pointer of binary data
+     * @param size Size of binary data
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool set_bin(const void *data, uint32_t size);
+
+    /** Start binary message
+     *
+     * Writes only the header, the caller appends size bytes of data
+     * (e.g. with set_raw() or a separate write).
+     *
+     * @param size Size of binary data
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool start_bin(uint32_t size);
+
+    /** Set array of float(32bit) messages
+     *
+     * Every element is written as a float32, whatever set_compact() says,
+     * with a single capacity check and one conversion loop. Without
+     * compaction this is the output of start_array(n) and n set_float().
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_float_array(const float *v, uint32_t n);
+
+    /** Set array of int16 messages
+     *
+     * Every element is encoded as int16 (fixed width, no narrowing).
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_s16_array(const int16_t *v, uint32_t n);
+
+    /** Set array of uint32 messages
+     *
+     * Every element is encoded as uint32 (fixed width, no narrowing).
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_u32_array(const uint32_t *v, uint32_t n);
+
+    /** Set floats packed as binary (big endian float32, 4 bytes each)
+     *
+     * Densest form, the receiver has to know the layout. The byte swap
+     * runs 16 bytes at a time on targets with NEON or SSSE3.
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_float_bin(const float *v, uint32_t n);
+
+    /** Set int16 values packed as binary (big endian, 2 bytes each)
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_s16_bin(const int16_t *v, uint32_t n);
+
+    /** Set uint32 values packed as binary (big endian, 4 bytes each)
+     *
+     * @param v Pointer of values
+     * @param n Number of values
+     * @retval true Success
+     * @retval false Failure (nothing is written)
+     */
+    bool set_u32_bin(const uint32_t *v, uint32_t n);
+
+    /** Set extension message
+     *
+     * @param type extension type (0 to 127 are application defined)
+     * @param data Pointer of extension data
+     * @param size Size of extension data
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool set_ext(int8_t type, const void *data, uint32_t size);
+
+    /** Start extension message
+     *
+     * Writes only the header, the caller appends size bytes of data.
+     *
+     * @param type extension type
+     * @param size Size of extension data
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool start_ext(int8_t type, uint32_t size);
+
     /** Set raw message
      *
      * Insert the pre build message into buffer.
      * This function is not MessagePack standard.
      *
-     * @param data Pointer of message string
-     * @param size Size of message string
+     * @param data Pointer of message data
+     * @param size Size of message data
      * @retval true Success
      * @retval false Failure
      */
-    bool set_raw(const char *data, uint8_t size);
+    bool set_raw(const char *data, uint32_t size);
 
     /** associate a key with value (bool)
      *
@@ -340,7 +544,99 @@ public:
      */
     bool map(const std::string& k, const std::string& v);
 
+    /** associate a key with value (bool), no std::string conversion
+     *
+     * @param k key string
+     * @param v bool value(true/false)
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, bool v);
+
+    /** associate a key with value (uint8_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, uint8_t v);
+
+    /** associate a key with value (uint16_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, uint16_t v);
+
+    /** associate a key with value (uint32_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, uint32_t v);
+
+    /** associate a key with value (int8_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, int8_t v);
+
+    /** associate a key with value (int16_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, int16_t v);
+
+    /** associate a key with value (int32_t), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, int32_t v);
+
+    /** associate a key with value (float), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, float v);
+
+    /** associate a key with value (double), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, double v);
+
+    /** associate a key with value (const char*), no std::string conversion
+     *
+     * @param k key string
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool map(const char *k, const char * v);
+
 private:
+    friend class uMPReader;
+
     enum MpTag{
         TAG_POSITIVE_FIXNUM = 0x00,
         TAG_FIXMAP          = 0x80,
@@ -349,12 +645,12 @@ private:
         TAG_NIL             = 0xc0,
         TAG_FALSE           = 0xc2,
         TAG_TRUE            = 0xc3,
-//      TAG_BIN8            = 0xc4,
-//      TAG_BIN16           = 0xc5,
-//      TAG_BIN32           = 0xc6,
-//      TAG_EXT8            = 0xc7,
-//      TAG_EXT16           = 0xc8,
-//      TAG_EXT32           = 0xc9,
+        TAG_BIN8            = 0xc4,
+        TAG_BIN16           = 0xc5,
+        TAG_BIN32           = 0xc6,
+        TAG_EXT8            = 0xc7,
+        TAG_EXT16           = 0xc8,
+        TAG_EXT32           = 0xc9,
         TAG_FLOAT32         = 0xca,
         TAG_FLOAT64         = 0xcb,
         TAG_U8              = 0xcc,
@@ -365,16 +661,18 @@ private:
         TAG_S16             = 0xd1,
         TAG_S32             = 0xd2,
         TAG_S64             = 0xd3,
-//      TAG_FIXEXT1         = 0xd4,
-//      TAG_FIXEXT2         = 0xd5,
-//      TAG_FIXEXT16        = 0xd8,
+        TAG_FIXEXT1         = 0xd4,
+        TAG_FIXEXT2         = 0xd5,
+        TAG_FIXEXT4         = 0xd6,
+        TAG_FIXEXT8         = 0xd7,
+        TAG_FIXEXT16        = 0xd8,
         TAG_STR8            = 0xd9,
-//      TAG_STR16           = 0xda,
-//      TAG_STR32           = 0xdb,
-//      TAG_ARRAY16         = 0xdc,
-//      TAG_ARRAY32         = 0xdd,
-//      TAG_MAP16           = 0xde,
-//      TAG_MAP32           = 0xdf,
+        TAG_STR16           = 0xda,
+        TAG_STR32           = 0xdb,
+        TAG_ARRAY16         = 0xdc,
+        TAG_ARRAY32         = 0xdd,
+        TAG_MAP16           = 0xde,
+        TAG_MAP32           = 0xdf,
         TAG_NEGATIVE_FIXNUM = 0xe0
     };
 
@@ -382,6 +680,16 @@ private:
     uint8_t   *_buf;
     uint32_t  _ptr;
     uint32_t  _nbuf;
+    bool      _own;
+    uint8_t   _compact;
+
+    /** Insert an integer with its tag
+     *
+     * @param tag format tag
+     * @param v value, the low size bytes are written big endian
+     * @param size value size
+     */
+    bool set_tagged(uint8_t tag, uint64_t v, uint32_t size);
 
     /** Insert sigle byte fomrat message
      *
@@ -400,6 +708,13 @@ private:
      */
     bool set_buffer(const uint8_t *c, size_t size);
 
+    /** Reserve space for multi byte fomrat message
+     *
+     * @param size Size to reserve
+     * @return Pointer of reserved space, NULL on buffer overflow
+     */
+    uint8_t *reserve(uint64_t size);
+
     /** Endian converter - 16bit data
      *
      * @param t 16bit data
@@ -422,4 +737,133 @@ private:
     template<typename T> T to_be64(T t);
 };
 
+/** Subset of MessagePack decoder.
+ *
+ * Reads from a buffer without copying; strings, binaries and skipped
+ * objects are returned as pointers into it. A failed call leaves the
+ * read position unchanged.
+ */
+class uMPReader {
+public:
+    /** uMPReader
+     *
+     * @param buf Pointer of message buffer
+     * @param size Size of message buffer
+     */
+    uMPReader(const uint8_t *buf, uint32_t size) : _buf(buf), _ptr(0), _nbuf(size) {}
+
+    /** Get read position
+     *
+     * @return offset from the start of the buffer
+     */
+    inline uint32_t get_pos(){ return _ptr; }
+
+    /** Get number of unread bytes
+     *
+     * @return remaining bytes
+     */
+    inline uint32_t get_remaining() const { return _nbuf - _ptr; }
+
+    /** Skip one complete object (including nested arrays and maps)
+     *
+     * @param data Pointer of the skipped object (optional)
+     * @param size Size of the skipped object (optional)
+     * @retval true Success
+     * @retval false Failure (truncated or invalid data)
+     */
+    bool skip(const uint8_t **data = NULL, uint32_t *size = NULL);
+
+    /** Get array header
+     *
+     * @param size Number of array elements
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_array(uint32_t *size);
+
+    /** Get map header
+     *
+     * @param size Number of map pairs
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_map(uint32_t *size);
+
+    /** Get string
+     *
+     * @param data Pointer of string (not null terminated)
+     * @param size Size of string
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_str(const char **data, uint32_t *size);
+
+    /** Get binary
+     *
+     * @param data Pointer of binary
+     * @param size Size of binary
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_bin(const uint8_t **data, uint32_t *size);
+
+    /** Get extension
+     *
+     * @param type extension type
+     * @param data Pointer of extension data
+     * @param size Size of extension data
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_ext(int8_t *type, const uint8_t **data, uint32_t *size);
+
+    /** Get unsigned integer (any non-negative int family)
+     *
+     * @param u value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_uint(uint64_t *u);
+
+    /** Get signed integer (any int family fitting int64_t)
+     *
+     * @param i value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_sint(int64_t *i);
+
+    /** Get boolean
+     *
+     * @param b value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_bool(bool *b);
+
+private:
+    const uint8_t *_buf;
+    uint32_t  _ptr;
+    uint32_t  _nbuf;
+
+    /** Read object header
+     *
+     * @param tag format byte
+     * @param len payload length (str/bin/ext) or element count (array/map)
+     * @param type extension type
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_header(uint8_t *tag, uint32_t *len, int8_t *type);
+
+    /** Read big endian value
+     *
+     * @param size 1, 2, 4 or 8 bytes
+     * @param v value
+     * @retval true Success
+     * @retval false Failure
+     */
+    bool get_be(uint32_t size, uint64_t *v);
+};
+
 #endif